@@ -50,6 +50,10 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
 
+/* How long to wait for a command's completion interrupt, in
+   timer ticks, before deciding that it was lost. */
+#define COMPLETION_TIMEOUT TIMER_FREQ
+
 /* An ATA device. */
 struct ata_disk
   {
@@ -87,6 +91,7 @@ static void identify_ata_device (struct ata_disk *);
 
 static void select_sector (struct ata_disk *, block_sector_t);
 static void issue_pio_command (struct channel *, uint8_t command);
+static bool wait_completion (struct channel *);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -273,7 +278,7 @@ identify_ata_device (struct ata_disk *d)
      into our buffer. */
   select_device_wait (d);
   issue_pio_command (c, CMD_IDENTIFY_DEVICE);
-  sema_down (&c->completion_wait);
+  wait_completion (c);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
@@ -349,7 +354,7 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
   lock_acquire (&c->lock);
   select_sector (d, sec_no);
   issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
+  wait_completion (c);
   if (!wait_while_busy (d))
     PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
   input_sector (c, buffer);
@@ -372,7 +377,8 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   if (!wait_while_busy (d))
     PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
   output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (!wait_completion (c))
+    wait_while_busy (d);
   lock_release (&c->lock);
 }
 
@@ -414,6 +420,31 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
+/* Waits for the interrupt that signals that the command last
+   issued on channel C is complete, and returns true.  If it does
+   not arrive within COMPLETION_TIMEOUT, assumes that it was lost
+   and returns false, in which case the caller should poll the
+   status register to find out when the command completes. */
+static bool
+wait_completion (struct channel *c)
+{
+  enum intr_level old_level;
+
+  if (sema_down_timeout (&c->completion_wait, COMPLETION_TIMEOUT))
+    return true;
+
+  /* Stop expecting the interrupt, and throw it away if it came
+     in just now, so that it can't complete the next command. */
+  old_level = intr_disable ();
+  c->expecting_interrupt = false;
+  sema_try_down (&c->completion_wait);
+  intr_set_level (old_level);
+
+  inb (reg_status (c));                 /* Acknowledge interrupt. */
+  printf ("%s: lost interrupt, polling\n", c->name);
+  return false;
+}
+
 /* Reads a sector from channel C's data register in PIO mode into
    SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
 static void
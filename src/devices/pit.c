@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -39,6 +36,9 @@
        it is 1, for the second half it is 0.  This is useful for
        generating a tone on a speaker.
 
+     - Mode 0 is a single pulse, which pit_start_oneshot() sets
+       up.
+
      - Other modes are less useful.
 
    FREQUENCY is the number of periods per second, in Hz. */
@@ -81,3 +81,51 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts CHANNEL counting down COUNT cycles of the PIT clock, in
+   mode 0, "interrupt on terminal count": the channel's output
+   goes from 0 to 1 when the count runs out and then stays at 1,
+   so channel 0 interrupts just once.  COUNT must be between 1
+   and 65536. */
+void
+pit_start_oneshot (int channel, unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (count >= 1 && count <= 65536);
+
+  /* A count of 65536 is written as 0. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current count of CHANNEL, which counts down at
+   PIT_HZ.  If OUTPUT is nonnull, stores the state of the
+   channel's output in *OUTPUT, which in mode 0 tells whether the
+   count has already run out. */
+unsigned
+pit_read_count (int channel, bool *output)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Latch the status and count of CHANNEL with the read-back
+     command, then read the status byte and the count, low byte
+     first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (1 << (channel + 1)));
+  status = inb (PIT_PORT_COUNTER (channel));
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  if (output != NULL)
+    *output = (status & 0x80) != 0;
+  return lo | (hi << 8);
+}
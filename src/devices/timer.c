@@ -20,27 +20,103 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
-/* List of all threads that are blocked in timer_sleep*/
-static struct list sleep_list;
+/* Alarms.
+
+   Pending alarms are kept in a hierarchical timing wheel, so
+   that setting and canceling one takes constant time.  Level L
+   of the wheel has WHEEL_SLOTS slots, each covering
+   WHEEL_SLOTS**L ticks, and holds the alarms due less than
+   WHEEL_SLOTS**(L+1) ticks after wheel_clk.  Level 0 thus has a
+   slot for each of the next WHEEL_SLOTS ticks.  Each time
+   wheel_clk passes into a new slot of level L > 0, the alarms in
+   that slot "cascade" down to the levels below.  An alarm due
+   further ahead than the top level reaches is put in the top
+   level's last slot, and set again when it cascades down to
+   level 0 too early.
+
+   Alarms fire in the timer interrupt, so the wheel is protected
+   by disabling interrupts.  See [Varghese] for more on timing
+   wheels. */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static int64_t wheel_clk;       /* Next tick to process. */
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
-extern struct thread *idle_thread;
+/* Dynamic ticks.
+
+   There is no point in interrupting an idle CPU TIMER_FREQ times
+   a second just to count ticks.  When a timer interrupt finds the
+   CPU idle, it stops the periodic tick and sets the PIT to
+   interrupt once, at the first tick that has work to do: the
+   earliest alarm, a cascade in the timer wheel, or the next
+   once-a-second MLFQS update.  That interrupt counts the ticks
+   that went by unobserved and restarts the periodic tick.
+
+   The PIT's 16-bit counter limits a one-shot to IDLE_TICKS_MAX
+   ticks, about 55 ms.  The one-shot is set to end exactly on a
+   tick boundary, so the tick count does not drift.  If some
+   other interrupt gives the CPU work first, the scheduler calls
+   timer_idle_exit() as soon as it switches away from the idle
+   thread, whether from the idle loop or straight from the
+   interrupt handler.  That counts the ticks that have gone by so
+   far, and sets the PIT to interrupt at the next boundary, where
+   the periodic tick resumes.  Setting an alarm does the same. */
+
+/* PIT cycles per timer tick, as pit_configure_channel() rounds. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Most ticks that one PIT one-shot can cover. */
+#define IDLE_TICKS_MAX (65536 / TICK_CYCLES)
+
+/* Monotonic clock.
+
+   timer_ns() reads the CPU's time-stamp counter, which counts
+   clock cycles, and scales it to nanoseconds.  The TSC's rate
+   is measured against the PIT at boot, by timer_calibrate().
+   Until then, timer_ns() goes by timer ticks.
+
+   A cycle count is converted to nanoseconds by multiplying by
+   tsc_mult, the length of a cycle in units of 2**-tsc_shift ns,
+   and shifting right by tsc_shift.  tsc_shift is as large as it
+   can be with tsc_mult still fitting in 32 bits, for
+   precision. */
+#define NS_PER_SEC (1000 * 1000 * 1000)
+#define TSC_CAL_TICKS 5         /* Ticks to measure the TSC over. */
+static uint64_t tsc_base;       /* A TSC reading. */
+static int64_t ns_base;         /* Value of timer_ns() at tsc_base. */
+static uint32_t tsc_mult;       /* Scaled ns per cycle, 0 if unknown. */
+static int tsc_shift;
+
+static int64_t oneshot_ticks;   /* Ticks the one-shot covers, or 0. */
+static unsigned oneshot_count;  /* PIT count the one-shot started at. */
 
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void tsc_calibrate (void);
+static void idle_enter (bool restarted);
+static void stop_oneshot (void);
+static void wheel_insert (struct alarm *);
+static void wheel_advance (void);
+static alarm_func wake_thread;
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
-  list_init (&sleep_list);
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -70,6 +146,48 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  tsc_calibrate ();
+}
+
+/* Measures the rate of the TSC over TSC_CAL_TICKS timer ticks
+   and sets up timer_ns() to use it. */
+static void
+tsc_calibrate (void)
+{
+  uint64_t start_tsc, end_tsc, hz;
+  enum intr_level old_level;
+  int64_t start;
+  uint32_t mult;
+  int shift;
+
+  /* Wait for a timer tick, then count cycles until another
+     TSC_CAL_TICKS go by. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  start = ticks;
+  start_tsc = timer_cycles ();
+  while (ticks - start < TSC_CAL_TICKS)
+    barrier ();
+  end_tsc = timer_cycles ();
+
+  hz = (end_tsc - start_tsc) * TIMER_FREQ / TSC_CAL_TICKS;
+  ASSERT (hz > 0);
+  for (shift = 32; ((uint64_t) NS_PER_SEC << shift) / hz > UINT32_MAX;
+       shift--)
+    continue;
+  mult = ((uint64_t) NS_PER_SEC << shift) / hz;
+
+  /* END_TSC was read at the start of tick START +
+     TSC_CAL_TICKS, where the tick-based clock reads the same, so
+     the clock does not jump. */
+  old_level = intr_disable ();
+  tsc_base = end_tsc;
+  ns_base = (start + TSC_CAL_TICKS) * (NS_PER_SEC / TIMER_FREQ);
+  tsc_shift = shift;
+  tsc_mult = mult;
+  intr_set_level (old_level);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -90,14 +208,36 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
-static
-bool
-time_compare_less(const struct list_elem *a,
-                  const struct list_elem *b,
-                  void *aux UNUSED) {
-    const struct thread *t_a = list_entry(a, struct thread, sleepelem);
-    const struct thread *t_b = list_entry(b, struct thread, sleepelem);
-    return (t_a->wake_up_time < t_b->wake_up_time);
+/* Returns the CPU's time-stamp counter, the number of clock
+   cycles since it was reset.  See [IA32-v2b] "RDTSC". */
+uint64_t
+timer_cycles (void)
+{
+  uint64_t tsc;
+
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the number of nanoseconds since the OS booted.  The
+   clock never goes backward.  Before timer_calibrate() it only
+   advances once per timer tick. */
+int64_t
+timer_ns (void)
+{
+  uint64_t delta;
+  uint32_t hi, lo;
+
+  if (tsc_mult == 0)
+    return timer_ticks () * (NS_PER_SEC / TIMER_FREQ);
+
+  /* DELTA * tsc_mult needs up to 96 bits, so multiply each half
+     of DELTA separately. */
+  delta = timer_cycles () - tsc_base;
+  hi = delta >> 32;
+  lo = delta;
+  return ns_base + (((uint64_t) hi * tsc_mult) << (32 - tsc_shift))
+                 + (((uint64_t) lo * tsc_mult) >> tsc_shift);
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
@@ -105,22 +245,25 @@ time_compare_less(const struct list_elem *a,
 void
 timer_sleep (int64_t ticks) 
 {
-  if (ticks == 0)
-    return;
-  int64_t start = timer_ticks ();
+  struct alarm alarm;
+  enum intr_level old_level;
 
+  if (ticks <= 0)
+    return;
   ASSERT (intr_get_level () == INTR_ON);
-  //while (timer_elapsed (start) < ticks)
-    //thread_yield ();
-  struct thread* t = thread_current();
-
-  t->wake_up_time = start + ticks;
-  enum intr_level old = intr_disable ();
-  list_insert_ordered(&sleep_list, &t->sleepelem, time_compare_less, NULL);
-  //printf("list_size() = %u\n",list_size(&sleep_list));
-  //printf("1.tid = %d, wake_up_time = %lld, start = %lld, ticks = %lld.\n", t->tid, t->wake_up_time, start, ticks);
-  thread_block();
-  intr_set_level(old);
+
+  alarm_init (&alarm, wake_thread, thread_current ());
+  old_level = intr_disable ();
+  alarm_set (&alarm, ticks + timer_ticks ());
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Alarm function for timer_sleep(): wakes up thread T_. */
+static void
+wake_thread (void *t_)
+{
+  thread_unblock (t_);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -186,6 +329,191 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Initializes ALARM to call FUNC, passing AUX, when it fires.
+   The alarm is not set. */
+void
+alarm_init (struct alarm *alarm, alarm_func *func, void *aux)
+{
+  ASSERT (alarm != NULL);
+  ASSERT (func != NULL);
+
+  alarm->func = func;
+  alarm->aux = aux;
+  alarm->pending = false;
+}
+
+/* Sets ALARM, which must not be pending, to fire at the timer
+   interrupt for tick EXPIRES, or at the next timer interrupt if
+   EXPIRES has already passed.  FUNC will be called in the timer
+   interrupt handler, with interrupts off, so it must not sleep.
+
+   May be called from an interrupt handler. */
+void
+alarm_set (struct alarm *alarm, int64_t expires)
+{
+  enum intr_level old_level;
+
+  ASSERT (alarm != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!alarm->pending);
+  alarm->expires = expires;
+  alarm->pending = true;
+  wheel_insert (alarm);
+
+  /* The periodic tick may be stopped until past EXPIRES. */
+  if (oneshot_ticks > 0)
+    stop_oneshot ();
+  intr_set_level (old_level);
+}
+
+/* Cancels ALARM.  Returns true if it was pending, false if it
+   had already fired or was never set, in which case its function
+   may already have run.  Once this returns, the alarm's function
+   will not be called until it is set again, so the caller may
+   then free ALARM.
+
+   May be called from an interrupt handler. */
+bool
+alarm_cancel (struct alarm *alarm)
+{
+  enum intr_level old_level;
+  bool was_pending;
+
+  ASSERT (alarm != NULL);
+
+  old_level = intr_disable ();
+  was_pending = alarm->pending;
+  if (was_pending)
+    {
+      list_remove (&alarm->elem);
+      alarm->pending = false;
+    }
+  intr_set_level (old_level);
+
+  return was_pending;
+}
+
+/* Adds ALARM to the slot of the timer wheel where it belongs.
+   Interrupts must be off. */
+static void
+wheel_insert (struct alarm *alarm)
+{
+  int64_t expires = alarm->expires;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (expires < wheel_clk)
+    expires = wheel_clk;
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (expires - wheel_clk < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (expires - wheel_clk >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+    expires = wheel_clk + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & (WHEEL_SLOTS - 1)],
+                  &alarm->elem);
+}
+
+/* Processes the timer wheel up to and including the current
+   tick, firing the alarms that are due.  Called from the timer
+   interrupt. */
+static void
+wheel_advance (void)
+{
+  ASSERT (intr_context ());
+
+  while (wheel_clk <= ticks)
+    {
+      struct list *slot = &wheel[0][wheel_clk & (WHEEL_SLOTS - 1)];
+      struct list due;
+      int level;
+
+      /* Cascade the slot that wheel_clk enters at each level
+         whose slots begin here. */
+      for (level = 1; level < WHEEL_LEVELS; level++)
+        {
+          struct list *upper;
+
+          if ((wheel_clk & (((int64_t) 1 << (WHEEL_BITS * level)) - 1)) != 0)
+            break;
+          upper = &wheel[level][(wheel_clk >> (WHEEL_BITS * level))
+                                & (WHEEL_SLOTS - 1)];
+          while (!list_empty (upper))
+            wheel_insert (list_entry (list_pop_front (upper),
+                                      struct alarm, elem));
+        }
+
+      /* Take this tick's alarms out of the wheel before firing
+         them, so that an alarm set from an alarm function for
+         this tick or earlier goes into the next tick's slot. */
+      list_init (&due);
+      if (!list_empty (slot))
+        list_splice (list_end (&due), list_begin (slot), list_end (slot));
+      wheel_clk++;
+
+      while (!list_empty (&due))
+        {
+          struct alarm *a = list_entry (list_pop_front (&due),
+                                        struct alarm, elem);
+          if (a->expires >= wheel_clk)
+            {
+              /* Was too far ahead for the wheel. */
+              wheel_insert (a);
+              continue;
+            }
+          a->pending = false;
+          a->func (a->aux);
+        }
+    }
+}
+
+/* Called by the scheduler, with interrupts off, when this CPU
+   switches from its idle thread to another thread.  If the
+   periodic tick was stopped, accounts for the ticks that have
+   passed since, and arranges for the periodic tick to resume at
+   the next tick boundary. */
+void
+timer_idle_exit (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks > 0)
+    stop_oneshot ();
+}
+
+/* Accounts for the ticks that have gone by since the periodic
+   tick stopped, and arranges for it to resume at the next tick
+   boundary.  Interrupts must be off. */
+static void
+stop_oneshot (void)
+{
+  unsigned count, elapsed;
+  int64_t passed;
+  bool expired;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (oneshot_ticks > 0);
+
+  /* If the one-shot has run out, its interrupt is pending and
+     will take care of everything. */
+  count = pit_read_count (0, &expired);
+  if (expired)
+    return;
+
+  elapsed = oneshot_count - count;
+  passed = elapsed / TICK_CYCLES;
+  ASSERT (passed < oneshot_ticks);
+
+  ticks += passed;
+  thread_tick_idle (passed);
+  oneshot_count = (passed + 1) * TICK_CYCLES - elapsed;
+  oneshot_ticks = 1;
+  pit_start_oneshot (0, oneshot_count);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
@@ -197,42 +525,89 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
-  if (ticks % 1000 == 0) printf("ticks = %lld.\n", ticks);
-  while (!list_empty(&sleep_list))
-  {
-    struct list_elem *front = list_front(&sleep_list);
-    struct thread* t = list_entry(front, struct thread, sleepelem);
+  bool restarted = false;
 
+  if (oneshot_ticks > 0)
+    {
+      /* All but the last tick of the one-shot went by while the
+         CPU was idle. */
+      ticks += oneshot_ticks - 1;
+      thread_tick_idle (oneshot_ticks - 1);
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+      restarted = true;
+    }
 
-    if (t->wake_up_time > ticks) break;
-    //printf("2.tid = %d, wake_up_time = %lld, ticks = %lld.\n", t->tid, t->wake_up_time, ticks);
-
-    thread_unblock(t);
-    list_pop_front(&sleep_list);
-  }
+  ticks++;
+  thread_tick ();
+  wheel_advance ();
   if (thread_mlfqs)
   {
     struct thread *t = thread_current ();
-    if (t != idle_thread)
+    if (!thread_is_idle (t))
     {
       t->recent_cpu = fix_add(t->recent_cpu, fix_int(1));
     }
     if (timer_ticks () % TIMER_FREQ == 0)
     {
       calculate_load_avg ();
-      thread_foreach(calculate_recent_cpu, NULL);
+      decay_recent_cpu ();
     }
-    if (timer_ticks () % 4 == 0)
+    /* Between decays, only the running thread's recent_cpu
+       changes, so no other thread's priority can. */
+    if (timer_ticks () % 4 == 0 && !thread_is_idle (t))
     {
-      thread_foreach (calculate_priority_mlfqs, NULL);
+      calculate_priority_mlfqs (t, NULL);
     }
     if (need_yield ())
     {
       intr_yield_on_return();
     }
   }
+
+  if (thread_cpu_idle ())
+    idle_enter (restarted);
+}
+
+/* Stops the periodic tick, if there is more than one tick before
+   the next one that has work to do, by starting a one-shot that
+   ends on that tick's boundary.  Called at a timer interrupt when
+   the CPU is idle.  RESTARTED is true if this interrupt just
+   restarted the periodic tick. */
+static void
+idle_enter (bool restarted)
+{
+  int64_t idle_ticks;
+  unsigned count;
+
+  ASSERT (intr_context ());
+  ASSERT (oneshot_ticks == 0);
+  ASSERT (wheel_clk == ticks + 1);
+
+  /* Stop at the first tick with alarms due or with a cascade to
+     do.  Only level 0 holds alarms due so soon. */
+  for (idle_ticks = 1; idle_ticks < IDLE_TICKS_MAX; idle_ticks++)
+    {
+      int64_t tick = ticks + idle_ticks;
+      if ((tick & (WHEEL_SLOTS - 1)) == 0
+          || !list_empty (&wheel[0][tick & (WHEEL_SLOTS - 1)]))
+        break;
+    }
+  if (thread_mlfqs && TIMER_FREQ - ticks % TIMER_FREQ < idle_ticks)
+    idle_ticks = TIMER_FREQ - ticks % TIMER_FREQ;
+  if (idle_ticks < 2)
+    return;
+
+  /* COUNT is what is left of the current tick, which began when
+     the periodic counter last reloaded.  A counter that was just
+     restarted may not have loaded yet, so don't read it. */
+  count = restarted ? TICK_CYCLES : pit_read_count (0, NULL);
+  if (count == 0 || count > TICK_CYCLES)
+    return;
+
+  oneshot_ticks = idle_ticks;
+  oneshot_count = (idle_ticks - 1) * TICK_CYCLES + count;
+  pit_start_oneshot (0, oneshot_count);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -288,12 +663,23 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
-  else 
+  else if (num * TIMER_FREQ * 10 < denom)
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
+      /* Waiting for a timer tick would overshoot a wait of less
+         than a tenth of a tick many times over, so use a
+         busy-wait loop for more accurate timing. */
       real_time_delay (num, denom); 
     }
+  else
+    {
+      /* Sleep until the first tick boundary at least NUM/DENOM
+         seconds away: the next one, if there is enough left of
+         the current tick, otherwise the one after.  The PIT's
+         count is what is left of the current tick. */
+      unsigned count = pit_read_count (0, NULL);
+      timer_sleep (count <= TICK_CYCLES && count >= num * PIT_HZ / denom
+                   ? 1 : 2);
+    }
 }
 
 /* Busy-wait for approximately NUM/DENOM seconds. */
@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -13,6 +15,10 @@ void timer_calibrate (void);
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
 
+/* Fine-grained time. */
+uint64_t timer_cycles (void);
+int64_t timer_ns (void);
+
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
@@ -24,6 +30,24 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+void timer_idle_exit (void);
+
+/* An alarm, which calls a function from the timer interrupt
+   when a given tick arrives. */
+typedef void alarm_func (void *aux);
+struct alarm
+  {
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+    int64_t expires;            /* Tick to fire at. */
+    alarm_func *func;           /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    bool pending;               /* Set but not yet fired or canceled? */
+  };
+
+void alarm_init (struct alarm *, alarm_func *, void *aux);
+void alarm_set (struct alarm *, int64_t expires);
+bool alarm_cancel (struct alarm *);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,169 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* Each element of a pairing heap is the root of a tree in which
+   no child is less than its parent.  An element's children form
+   a doubly linked list, starting from its `child' member and
+   continuing through the children's `next' members.  Each
+   child's `prev' member points to its previous sibling, except
+   that the first child's points back to the parent, so that any
+   element can be unlinked from its tree in O(1) time.
+
+   Two trees are melded by making the root that is not less than
+   the other the first child of the other.  Insertion melds a
+   one-element tree into the heap.  Removing the root leaves its
+   children as separate trees, which are melded in pairs from
+   left to right and then the pairs are melded from right to
+   left.  This "two-pass" pairing is what gives removal its
+   O(lg n) amortized bound. */
+
+static struct heap_elem *meld (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+
+/* Initializes HEAP as an empty heap whose elements are ordered
+   by LESS given auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux)
+{
+  ASSERT (heap != NULL);
+  ASSERT (less != NULL);
+
+  heap->root = NULL;
+  heap->less = less;
+  heap->aux = aux;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (const struct heap *heap)
+{
+  ASSERT (heap != NULL);
+
+  return heap->root == NULL;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+heap_insert (struct heap *heap, struct heap_elem *elem)
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  elem->child = elem->next = elem->prev = NULL;
+  heap->root = meld (heap, heap->root, elem);
+}
+
+/* Returns the least element in HEAP, or any one of several
+   equal least elements.  HEAP must not be empty. */
+struct heap_elem *
+heap_top (const struct heap *heap)
+{
+  ASSERT (!heap_empty (heap));
+
+  return heap->root;
+}
+
+/* Removes and returns the least element in HEAP, as
+   heap_top().  HEAP must not be empty. */
+struct heap_elem *
+heap_pop (struct heap *heap)
+{
+  struct heap_elem *top = heap_top (heap);
+
+  heap->root = merge_pairs (heap, top->child);
+  return top;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP.  ELEM itself
+   is not compared with any other element, so its value may have
+   changed since it was inserted. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem)
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  if (elem == heap->root)
+    {
+      heap_pop (heap);
+      return;
+    }
+
+  /* Unlink ELEM's tree from its parent and siblings, then meld
+     what is left of it back into the heap. */
+  ASSERT (elem->prev != NULL);
+  if (elem->prev->child == elem)
+    elem->prev->child = elem->next;
+  else
+    elem->prev->next = elem->next;
+  if (elem->next != NULL)
+    elem->next->prev = elem->prev;
+  heap->root = meld (heap, heap->root, merge_pairs (heap, elem->child));
+}
+
+/* Melds the trees rooted at A and B, either of which may be
+   null, and returns the root of the result.  A and B must not
+   have siblings. */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+
+  if (heap->less (b, a, heap->aux))
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Melds the list of sibling trees that starts at FIRST, which
+   may be null, into a single tree and returns its root. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first)
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  /* First pass: meld pairs from left to right, pushing each
+     result onto PAIRS, so that PAIRS ends up right to left. */
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        {
+          b->next = b->prev = NULL;
+          a = meld (heap, a, b);
+        }
+      a->next = pairs;
+      pairs = a;
+    }
+
+  /* Second pass: meld the pairs from right to left. */
+  while (pairs != NULL)
+    {
+      struct heap_elem *a = pairs;
+
+      pairs = a->next;
+      a->next = NULL;
+      root = meld (heap, a, root);
+    }
+  if (root != NULL)
+    root->prev = NULL;
+  return root;
+}
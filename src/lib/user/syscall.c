@@ -182,3 +182,16 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int64_t
+clock_ns (void)
+{
+  int64_t ns;
+
+  /* The 64-bit result comes back in EDX:EAX. */
+  asm volatile ("pushl %[number]; int $0x30; addl $4, %%esp"
+                : "=A" (ns)
+                : [number] "i" (SYS_CLOCK)
+                : "memory");
+  return ns;
+}
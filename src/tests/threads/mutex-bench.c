@@ -0,0 +1,92 @@
+/* Measures the cost of acquiring and releasing a free lock and a
+   free mutex, by doing each many times in a row, then checks
+   that a mutex still excludes other threads when it is
+   contended, by having several threads yield while they hold
+   it. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define PAIR_CNT 100000
+#define THREAD_CNT 4
+#define ITER_CNT 100
+
+struct counter
+  {
+    struct mutex mutex;         /* Protects `value'. */
+    int value;                  /* Incremented by each thread. */
+    struct semaphore done;      /* Upped by each thread at exit. */
+  };
+
+static thread_func increment_thread;
+
+void
+test_mutex_bench (void) 
+{
+  struct lock lock;
+  struct mutex mutex;
+  struct counter counter;
+  int64_t start, lock_ns, mutex_ns;
+  int i;
+
+  lock_init (&lock);
+  start = timer_ns ();
+  for (i = 0; i < PAIR_CNT; i++)
+    {
+      lock_acquire (&lock);
+      lock_release (&lock);
+    }
+  lock_ns = timer_ns () - start;
+
+  mutex_init (&mutex);
+  start = timer_ns ();
+  for (i = 0; i < PAIR_CNT; i++)
+    {
+      mutex_acquire (&mutex);
+      mutex_release (&mutex);
+    }
+  mutex_ns = timer_ns () - start;
+
+  msg ("lock: %d acquire/release pairs in %lld ns (%lld ns each).",
+       PAIR_CNT, lock_ns, lock_ns / PAIR_CNT);
+  msg ("mutex: %d acquire/release pairs in %lld ns (%lld ns each).",
+       PAIR_CNT, mutex_ns, mutex_ns / PAIR_CNT);
+
+  mutex_init (&counter.mutex);
+  counter.value = 0;
+  sema_init (&counter.done, 0);
+  for (i = 0; i < THREAD_CNT; i++)
+    thread_create ("incrementer", PRI_DEFAULT, increment_thread, &counter);
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&counter.done);
+  if (counter.value != THREAD_CNT * ITER_CNT)
+    fail ("count is %d, should be %d",
+          counter.value, THREAD_CNT * ITER_CNT);
+  msg ("contended mutex counted to %d.", counter.value);
+  pass ();
+}
+
+/* Increments the counter in COUNTER_ ITER_CNT times, yielding to
+   the other threads while holding its mutex so that they have to
+   wait for it. */
+static void
+increment_thread (void *counter_) 
+{
+  struct counter *counter = counter_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      int value;
+
+      mutex_acquire (&counter->mutex);
+      value = counter->value;
+      thread_yield ();
+      counter->value = value + 1;
+      mutex_release (&counter->mutex);
+    }
+  sema_up (&counter->done);
+}
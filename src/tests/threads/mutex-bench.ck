@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+foreach my $kind ('lock', 'mutex') {
+    fail "missing $kind timing in output"
+      unless grep (/^\(mutex-bench\) $kind: \d+ acquire\/release pairs/,
+                   @output);
+}
+fail "missing contended count in output"
+  unless grep ($_ eq '(mutex-bench) contended mutex counted to 400.',
+               @output);
+fail "missing PASS in output"
+  unless grep ($_ eq '(mutex-bench) PASS', @output);
+
+pass;
@@ -38,6 +38,10 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"thread-create-bench", test_thread_create_bench},
+    {"mutex-bench", test_mutex_bench},
+    {"tickless-wake", test_tickless_wake},
+    {"timed-wait", test_timed_wait},
   };
 
 static const char *test_name;
@@ -32,6 +32,10 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_thread_create_bench;
+extern test_func test_mutex_bench;
+extern test_func test_tickless_wake;
+extern test_func test_timed_wait;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,43 @@
+/* Measures how long it takes to create a thread and wait for it
+   to exit, by doing that many times in a row.  Each thread exits
+   as soon as it runs, so this mostly times thread_create(), the
+   thread switches, and freeing the thread once it is dead. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 5000
+
+static thread_func exit_thread;
+
+void
+test_thread_create_bench (void) 
+{
+  struct semaphore done;
+  int64_t start, ticks;
+  int i;
+
+  sema_init (&done, 0);
+  start = timer_ticks ();
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      if (thread_create ("worker", PRI_DEFAULT, exit_thread, &done)
+          == TID_ERROR)
+        fail ("thread_create failed on iteration %d", i);
+      sema_down (&done);
+    }
+  ticks = timer_elapsed (start);
+
+  msg ("%d threads created and joined in %lld ticks (%lld ns each).",
+       THREAD_CNT, ticks, ticks * (1000000000 / TIMER_FREQ) / THREAD_CNT);
+  pass ();
+}
+
+static void
+exit_thread (void *done) 
+{
+  sema_up (done);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+fail "missing timing in output"
+  unless grep (/^\(thread-create-bench\) \d+ threads created and joined/,
+               @output);
+fail "missing PASS in output"
+  unless grep ($_ eq '(thread-create-bench) PASS', @output);
+
+pass;
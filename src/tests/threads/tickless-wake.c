@@ -0,0 +1,133 @@
+/* Checks that the timer tick keeps going after an interrupt
+   other than the timer's wakes up a thread while the CPU is
+   idle and the periodic tick is stopped.
+
+   An alarm makes the keyboard controller raise the auxiliary
+   (mouse) device's interrupt, IRQ 12.  The alarm fires at a
+   timer interrupt that finds the CPU idle, so the periodic tick
+   is stopped by the time IRQ 12 arrives.  Its handler ups a
+   semaphore that a thread of higher priority than the idle
+   thread is waiting on, so that the handler switches to that
+   thread on its way out.  That thread then busy-waits for a few
+   ticks of real time, by the CPU's time-stamp counter, and
+   fails if timer_ticks() ever stays the same for too long. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Keyboard controller registers and commands. */
+#define DATA_REG 0x60           /* Data register. */
+#define STATUS_REG 0x64         /* Status register (read). */
+#define CMD_REG 0x64            /* Command register (write). */
+#define STATUS_IBF 0x02         /* Input buffer full. */
+#define CMD_WRITE_MODE 0x60     /* Write command byte. */
+#define CMD_AUX_DISABLE 0xa7    /* Disable auxiliary device. */
+#define CMD_AUX_ENABLE 0xa8     /* Enable auxiliary device. */
+#define CMD_WRITE_AUX_OBUF 0xd3 /* Act as if aux device sent a byte. */
+
+/* Controller command byte: keyboard and aux interrupts on,
+   system flag set, scan code translation on. */
+#define MODE 0x47
+
+#define AUX_IRQ_VEC (0x20 + 12)
+
+#define TRIAL_CNT 5
+#define SPIN_TICKS 10
+#define NS_PER_TICK (1000000000 / TIMER_FREQ)
+
+static struct semaphore woken;
+
+static void kbc_command (uint8_t cmd);
+static void kbc_data (uint8_t data);
+static alarm_func raise_aux_irq;
+static intr_handler_func aux_interrupt;
+
+void
+test_tickless_wake (void) 
+{
+  int trial;
+
+  sema_init (&woken, 0);
+  intr_register_ext (AUX_IRQ_VEC, aux_interrupt, "test aux");
+  kbc_command (CMD_WRITE_MODE);
+  kbc_data (MODE);
+  kbc_command (CMD_AUX_ENABLE);
+
+  for (trial = 0; trial < TRIAL_CNT; trial++) 
+    {
+      struct alarm alarm;
+      int64_t start, last_change, now, max_gap;
+      int64_t ticks;
+
+      alarm_init (&alarm, raise_aux_irq, NULL);
+      alarm_set (&alarm, timer_ticks () + 2);
+      sema_down (&woken);
+
+      start = last_change = timer_ns ();
+      ticks = timer_ticks ();
+      max_gap = 0;
+      do
+        {
+          now = timer_ns ();
+          if (timer_ticks () != ticks)
+            {
+              if (now - last_change > max_gap)
+                max_gap = now - last_change;
+              ticks = timer_ticks ();
+              last_change = now;
+            }
+        }
+      while (now - start < SPIN_TICKS * NS_PER_TICK);
+      if (now - last_change > max_gap)
+        max_gap = now - last_change;
+
+      if (max_gap > 3 * NS_PER_TICK)
+        fail ("trial %d: timer ticks stopped for %lld ns", trial, max_gap);
+    }
+
+  kbc_command (CMD_AUX_DISABLE);
+  pass ();
+}
+
+/* Sends CMD to the keyboard controller. */
+static void
+kbc_command (uint8_t cmd) 
+{
+  while (inb (STATUS_REG) & STATUS_IBF)
+    continue;
+  outb (CMD_REG, cmd);
+}
+
+/* Sends DATA to the keyboard controller, as the argument to the
+   previous command. */
+static void
+kbc_data (uint8_t data) 
+{
+  while (inb (STATUS_REG) & STATUS_IBF)
+    continue;
+  outb (DATA_REG, data);
+}
+
+/* Alarm function that makes the keyboard controller raise IRQ 12
+   as soon as it can. */
+static void
+raise_aux_irq (void *aux UNUSED) 
+{
+  kbc_command (CMD_WRITE_AUX_OBUF);
+  kbc_data (0);
+}
+
+/* IRQ 12 handler.  Wakes up the test thread, which has higher
+   priority than the idle thread, so that this handler yields
+   to it on return. */
+static void
+aux_interrupt (struct intr_frame *f UNUSED) 
+{
+  inb (DATA_REG);
+  sema_up (&woken);
+}
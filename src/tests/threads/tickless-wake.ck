@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(tickless-wake) begin
+(tickless-wake) PASS
+(tickless-wake) end
+EOF
+pass;
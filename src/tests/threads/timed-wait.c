@@ -0,0 +1,108 @@
+/* Checks sema_down_timeout(), cond_wait_timeout(), and
+   lock_acquire_timeout().  Each of the first two is made to time
+   out, returning false, and then to be woken up well before its
+   deadline by a lower-priority thread, returning true.  Then a
+   higher-priority thread waits for a lock that the main thread
+   holds, donating its priority, until it times out; the main
+   thread's priority must then drop back to what it was. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Long enough that no wait this long should ever time out. */
+#define LONG_WAIT 1000
+
+struct cond_info
+  {
+    struct lock lock;
+    struct condition cond;
+  };
+
+static thread_func sema_up_thread_func;
+static thread_func signal_thread_func;
+static thread_func timeout_thread_func;
+
+static const char *
+bool_name (bool b)
+{
+  return b ? "true" : "false";
+}
+
+void
+test_timed_wait (void) 
+{
+  struct semaphore sema;
+  struct cond_info info;
+  struct lock lock;
+  bool ok;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  sema_init (&sema, 0);
+  ok = sema_down_timeout (&sema, 10);
+  msg ("sema_down_timeout with no sema_up returned %s.", bool_name (ok));
+  thread_create ("sema-up", PRI_DEFAULT - 1, sema_up_thread_func, &sema);
+  ok = sema_down_timeout (&sema, LONG_WAIT);
+  msg ("sema_down_timeout woken by sema_up returned %s.", bool_name (ok));
+
+  lock_init (&info.lock);
+  cond_init (&info.cond);
+  lock_acquire (&info.lock);
+  ok = cond_wait_timeout (&info.cond, &info.lock, 10);
+  msg ("cond_wait_timeout with no signal returned %s.", bool_name (ok));
+  thread_create ("signal", PRI_DEFAULT - 1, signal_thread_func, &info);
+  ok = cond_wait_timeout (&info.cond, &info.lock, LONG_WAIT);
+  msg ("cond_wait_timeout woken by cond_signal returned %s.",
+       bool_name (ok));
+  if (!lock_held_by_current_thread (&info.lock))
+    fail ("cond_wait_timeout returned without the lock");
+  lock_release (&info.lock);
+
+  lock_init (&lock);
+  lock_acquire (&lock);
+  thread_create ("timeout", PRI_DEFAULT + 5, timeout_thread_func, &lock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 5, thread_get_priority ());
+  timer_sleep (50);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+  lock_release (&lock);
+}
+
+static void
+sema_up_thread_func (void *sema_) 
+{
+  struct semaphore *sema = sema_;
+
+  msg ("sema-up: upping the semaphore");
+  sema_up (sema);
+}
+
+static void
+signal_thread_func (void *info_) 
+{
+  struct cond_info *info = info_;
+
+  lock_acquire (&info->lock);
+  msg ("signal: signaling the condition");
+  cond_signal (&info->cond, &info->lock);
+  lock_release (&info->lock);
+}
+
+static void
+timeout_thread_func (void *lock_) 
+{
+  struct lock *lock = lock_;
+  bool ok;
+
+  ok = lock_acquire_timeout (lock, 10);
+  msg ("timeout: lock_acquire_timeout returned %s.", bool_name (ok));
+}
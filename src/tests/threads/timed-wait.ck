@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(timed-wait) begin
+(timed-wait) sema_down_timeout with no sema_up returned false.
+(timed-wait) sema-up: upping the semaphore
+(timed-wait) sema_down_timeout woken by sema_up returned true.
+(timed-wait) cond_wait_timeout with no signal returned false.
+(timed-wait) signal: signaling the condition
+(timed-wait) cond_wait_timeout woken by cond_signal returned true.
+(timed-wait) This thread should have priority 36.  Actual priority: 36.
+(timed-wait) timeout: lock_acquire_timeout returned false.
+(timed-wait) This thread should have priority 31.  Actual priority: 31.
+(timed-wait) end
+EOF
+pass;
@@ -0,0 +1,41 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Processor feature flags reported in EDX by CPUID leaf 1.
+   See [IA32-v2a] "CPUID". */
+#define CPUID_PSE 0x00000008    /* 4 MB pages. */
+#define CPUID_PGE 0x00002000    /* Global pages. */
+
+/* Control register 4 flags.  See [IA32-v3a] 2.5 "Control
+   Registers". */
+#define CR4_PSE 0x00000010      /* Page size extensions. */
+#define CR4_PGE 0x00000080      /* Page global enable. */
+
+/* Returns true if the processor supports all of the features in
+   FEATURES, a set of CPUID_* flags. */
+static inline bool
+cpu_has (uint32_t features)
+{
+  uint32_t eax = 1, ebx, ecx = 0, edx;
+
+  /* See [IA32-v2a] "CPUID". */
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+  return (edx & features) == features;
+}
+
+/* Sets FLAGS, a set of CR4_* flags, in control register 4. */
+static inline void
+cpu_set_cr4 (uint32_t flags)
+{
+  uint32_t cr4;
+
+  /* See [IA32-v2a] "MOV--Move to/from Control Registers". */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  cr4 |= flags;
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+#endif /* threads/cpu.h */
@@ -15,10 +15,13 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/kstack.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memstat.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
@@ -26,6 +29,7 @@
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -37,6 +41,10 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -96,8 +104,15 @@ main (void)
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
+  memstat_init ();
   malloc_init ();
   paging_init ();
+#ifdef USERPROG
+  pagedir_init ();
+#endif
+#ifdef VM
+  frame_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -125,6 +140,10 @@ main (void)
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
+#ifdef VM
+  swap_init ();
+  frame_start ();
+#endif
 #endif
 
   printf ("Boot complete.\n");
@@ -153,15 +172,35 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports 4 MB pages, each 4 MB region of RAM that
+   lies entirely in memory and contains no kernel text is mapped
+   by a single large PDE instead of a page table.  That takes 1
+   TLB entry instead of 1024 and saves a page of the kernel pool
+   per region.  The region that holds the kernel text still uses
+   4 kB pages, so that the text can be mapped read-only.
+
+   The kernel mapping is identical in every page directory, so
+   if the CPU supports it, its PTEs are marked global.  Global
+   TLB entries survive the CR3 reload on every process switch
+   (see [IA32-v3a] 3.12 "Translation Lookaside Buffers"). */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool large = cpu_has (CPUID_PSE);
+  bool global = cpu_has (CPUID_PGE);
+
+  /* Large pages must be enabled before we load a page directory
+     that uses them. */
+  if (large)
+    cpu_set_cr4 (CR4_PSE);
 
-  pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO
+                                        | PAL_TAG (MEM_PAGETABLE));
   pt = NULL;
   for (page = 0; page < init_ram_pages; page++)
     {
@@ -173,19 +212,42 @@ paging_init (void)
 
       if (pd[pde_idx] == 0)
         {
-          pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+          size_t region_pages = PTSPAN / PGSIZE;
+          char *region_end = vaddr + PTSPAN;
+
+          if (large && pte_idx == 0
+              && page + region_pages <= init_ram_pages
+              && (region_end <= &_start || vaddr >= &_end_kernel_text))
+            {
+              pd[pde_idx] = pde_create_large (vaddr);
+              if (global)
+                pd[pde_idx] |= PTE_G;
+              page += region_pages - 1;
+              continue;
+            }
+
+          pt = palloc_get_page (PAL_ASSERT | PAL_ZERO
+                                | PAL_TAG (MEM_PAGETABLE));
           pd[pde_idx] = pde_create (pt);
         }
 
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      if (global)
+        pt[pte_idx] |= PTE_G;
     }
 
+  /* Kernel stacks live beyond the RAM mapping, with page tables
+     of their own that every page directory will share. */
+  kstack_init (pd);
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+  if (global)
+    cpu_set_cr4 (CR4_PGE);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -256,9 +318,15 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-memsites"))
+        memstat_track_sites = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-vmstats"))
+        frame_print_exits = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -292,6 +360,13 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+/* Prints kernel memory usage by subsystem. */
+static void
+run_memstat (char **argv UNUSED)
+{
+  memstat_print ();
+}
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -309,6 +384,7 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"memstat", 1, run_memstat},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -357,6 +433,7 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  memstat            Print kernel memory usage by subsystem.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
@@ -379,8 +456,12 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -memsites          Track kernel memory by allocation site.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -vmstats           Print paging counts as each process exits.\n"
 #endif
           );
   shutdown_power_off ();
@@ -54,6 +54,7 @@ static void pic_end_of_interrupt (int irq);
 /* Interrupt Descriptor Table helpers. */
 static uint64_t make_intr_gate (void (*) (void), int dpl);
 static uint64_t make_trap_gate (void (*) (void), int dpl);
+static uint64_t make_task_gate (uint16_t tss_sel);
 static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
 /* Interrupt handlers. */
@@ -206,6 +207,19 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Registers internal interrupt VEC_NO to switch to the task
+   whose TSS has selector TSS_SEL, instead of invoking a handler
+   on the current stack.  Names the interrupt NAME for debugging
+   purposes.  See [IA32-v3a] 6.3 "Task Switching". */
+void
+intr_register_task (uint8_t vec_no, uint16_t tss_sel, const char *name)
+{
+  ASSERT (vec_no < 0x20);
+  ASSERT (intr_handlers[vec_no] == NULL);
+  idt[vec_no] = make_task_gate (tss_sel);
+  intr_names[vec_no] = name;
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
@@ -327,6 +341,18 @@ make_trap_gate (void (*function) (void), int dpl)
   return make_gate (function, dpl, 15);
 }
 
+/* Creates a task gate that switches to the task whose TSS has
+   selector TSS_SEL.  See [IA32-v3a] 5.11 "IDT Descriptors". */
+static uint64_t
+make_task_gate (uint16_t tss_sel)
+{
+  uint32_t e0 = (uint32_t) tss_sel << 16;   /* TSS segment selector. */
+  uint32_t e1 = ((1 << 15)                   /* Present. */
+                 | (5 << 8));                /* Task gate type. */
+
+  return e0 | ((uint64_t) e1 << 32);
+}
+
 /* Returns a descriptor that yields the given LIMIT and BASE when
    used as an operand for the LIDT instruction. */
 static inline uint64_t
@@ -0,0 +1,202 @@
+#include "threads/kstack.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* Kernel stacks.
+
+   Kernel memory is mapped one-to-one onto physical memory,
+   mostly with 4 MB pages, so there is no way to leave a hole
+   below a stack that lives there.  Instead, kernel stacks live
+   in a region of kernel virtual memory just past the end of that
+   mapping, divided into "slots" of KSTACK_PAGES pages each plus
+   an unmapped guard page below them:
+
+        +---------------------------------+
+        |          kernel stack           |  KSTACK_PAGES pages,
+        |                |                |  mapped on demand
+        |                V                |
+        +---------------------------------+
+        |           guard page            |  never mapped
+        +---------------------------------+
+
+   A stack that overflows runs into its guard page and faults,
+   instead of quietly overwriting whatever lies below it.
+
+   The page tables for the whole region are allocated by
+   kstack_init() at boot and installed in the initial page
+   directory, from which every other page directory copies its
+   kernel mappings, so mapping a stack page is visible in every
+   address space at once.  There are enough slots for every page
+   of RAM to be a stack, so we never run out of slots before we
+   run out of memory.
+
+   Threads are often short-lived, so kstack_free() keeps up to
+   POOL_SIZE freed stacks, still mapped, for kstack_alloc() to
+   hand out again.  Reusing one costs nothing beyond
+   reinitializing the `struct thread' at its top, instead of
+   allocating, mapping, and later unmapping and freeing its
+   pages.  Stack pages are not zeroed, new or reused, because
+   nothing reads a stack before writing it.
+
+   kstack_free() may be called with interrupts off, from the
+   scheduler, so the slot bitmap and the pool are protected by
+   disabling interrupts. */
+
+/* Pages in a slot, including the guard page. */
+#define SLOT_PAGES (KSTACK_PAGES + 1)
+
+/* Maximum number of freed stacks kept for reuse. */
+#define POOL_SIZE 8
+
+static uint8_t *region;                 /* Start of stack region. */
+static uint32_t *region_pd;             /* Page directory mapping it. */
+static struct bitmap *used_slots;       /* Slots in use. */
+static void *pool[POOL_SIZE];           /* Tops of freed stacks. */
+static size_t pool_cnt;                 /* Number of stacks in pool. */
+
+static void release (uint8_t *base);
+static uint32_t *lookup_pte (const void *vaddr);
+static void unmap_pages (uint8_t *base, size_t page_cnt);
+
+/* Sets up the kernel stack region and its page tables in page
+   directory PD, which must be the initial page directory. */
+void
+kstack_init (uint32_t *pd)
+{
+  size_t slot_cnt = init_ram_pages / KSTACK_PAGES;
+  size_t region_size = slot_cnt * SLOT_PAGES * PGSIZE;
+  uint8_t *region_end;
+  uint8_t *va;
+
+  region = (uint8_t *) PHYS_BASE + ROUND_UP (init_ram_pages * PGSIZE, PTSPAN);
+  region_end = region + region_size;
+  ASSERT (region_end > region);
+  region_pd = pd;
+
+  for (va = region; va < region_end; va += PTSPAN)
+    {
+      uint32_t *pt = palloc_get_page (PAL_ASSERT | PAL_ZERO
+                                      | PAL_TAG (MEM_PAGETABLE));
+      ASSERT (pd[pd_no (va)] == 0);
+      pd[pd_no (va)] = pde_create (pt);
+    }
+
+  used_slots = bitmap_create (slot_cnt);
+  if (used_slots == NULL)
+    PANIC ("kstack: no memory for slot map");
+}
+
+/* Allocates a kernel stack and returns its top, the address just
+   past its highest byte.  Returns a null pointer if memory is not
+   available. */
+void *
+kstack_alloc (void)
+{
+  enum intr_level old_level;
+  size_t slot, i;
+  uint8_t *base;
+
+  old_level = intr_disable ();
+  if (pool_cnt > 0)
+    {
+      void *top = pool[--pool_cnt];
+      intr_set_level (old_level);
+      return top;
+    }
+  slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  intr_set_level (old_level);
+  if (slot == BITMAP_ERROR)
+    return NULL;
+
+  base = region + (slot * SLOT_PAGES + 1) * PGSIZE;
+  for (i = 0; i < KSTACK_PAGES; i++)
+    {
+      void *kpage = palloc_get_page (PAL_TAG (MEM_THREAD));
+      if (kpage == NULL)
+        {
+          release (base);
+          return NULL;
+        }
+      *lookup_pte (base + i * PGSIZE) = pte_create_kernel (kpage, true);
+    }
+  return base + KSTACK_PAGES * PGSIZE;
+}
+
+/* Frees the kernel stack whose top is TOP, which must have been
+   returned by kstack_alloc().  May be called with interrupts
+   off. */
+void
+kstack_free (void *top)
+{
+  enum intr_level old_level;
+
+  ASSERT (((uint8_t *) top - region) % (SLOT_PAGES * PGSIZE) == 0);
+
+  old_level = intr_disable ();
+  if (pool_cnt < POOL_SIZE)
+    {
+      pool[pool_cnt++] = top;
+      intr_set_level (old_level);
+      return;
+    }
+  intr_set_level (old_level);
+
+  release ((uint8_t *) top - KSTACK_PAGES * PGSIZE);
+}
+
+/* Unmaps and frees the pages of the stack whose lowest page is
+   BASE, and frees its slot. */
+static void
+release (uint8_t *base)
+{
+  size_t ofs = base - PGSIZE - region;
+  enum intr_level old_level;
+
+  unmap_pages (base, KSTACK_PAGES);
+
+  old_level = intr_disable ();
+  ASSERT (bitmap_test (used_slots, ofs / (SLOT_PAGES * PGSIZE)));
+  bitmap_reset (used_slots, ofs / (SLOT_PAGES * PGSIZE));
+  intr_set_level (old_level);
+}
+
+/* Returns the page table entry for VADDR, which must be in the
+   stack region. */
+static uint32_t *
+lookup_pte (const void *vaddr)
+{
+  uint32_t *pt = pde_get_pt (region_pd[pd_no (vaddr)]);
+  return &pt[pt_no (vaddr)];
+}
+
+/* Unmaps and frees whichever of the PAGE_CNT pages starting at
+   BASE are mapped. */
+static void
+unmap_pages (uint8_t *base, size_t page_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint8_t *va = base + i * PGSIZE;
+      uint32_t *pte = lookup_pte (va);
+
+      if (*pte & PTE_P)
+        {
+          void *kpage = pte_get_page (*pte);
+          *pte = 0;
+
+          /* Every address space shares this mapping, so flush it
+             from the TLB whichever one is active. */
+          asm volatile ("invlpg (%0)" : : "r" (va) : "memory");
+          palloc_free_page (kpage);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef THREADS_KSTACK_H
+#define THREADS_KSTACK_H
+
+#include <stdint.h>
+
+/* Size of each kernel stack, in pages.  May be overridden at
+   compile time, e.g. with -DKSTACK_PAGES=4. */
+#ifndef KSTACK_PAGES
+#define KSTACK_PAGES 2
+#endif
+
+void kstack_init (uint32_t *pd);
+void *kstack_alloc (void);
+void kstack_free (void *top);
+
+#endif /* threads/kstack.h */
@@ -5,15 +5,22 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memstat.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
+   The size of each request, in bytes, is rounded up to the
+   nearest size class and assigned to the "descriptor" that
+   manages blocks of that size.  There are four size classes
+   between each pair of powers of 2 (16, 20, 24, 28, 32, 40, ...),
+   so no more than 20% or so of a block is ever wasted by
+   rounding, compared to almost half with classes that are
+   powers of 2.  The descriptor keeps a list of free blocks.  If
    the free list is nonempty, one of its blocks is used to
    satisfy the request.
 
@@ -32,7 +39,26 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Taking the descriptor's lock for every malloc() and free()
+   would be expensive, so each thread keeps a "magazine" of free
+   blocks for each descriptor in a side structure, allocated the
+   first time the thread calls malloc() or free().  Blocks in a
+   magazine count as in use as far as their arena is concerned.
+   Most calls just push or pop a block in the running thread's
+   own magazine, without any locking.  An empty magazine is
+   refilled from the free list, and a full one half emptied back
+   to it, MAG_BATCH blocks at a time under a single acquisition
+   of the lock.  A thread's magazines are emptied when it exits.
+
+   realloc() leaves a block where it is if the new size still
+   fits its size class, and grows or shrinks a big block in place
+   when the pages after it are free.
+
+   Every block handed out is charged to MEM_MALLOC in the kernel
+   memory statistics, along with the code that asked for it (see
+   memstat.c). */
 
 /* Descriptor. */
 struct desc
@@ -40,7 +66,7 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
-    struct lock lock;           /* Lock. */
+    struct mutex lock;          /* Lock. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -61,26 +87,83 @@ struct block
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+#define DESC_MAX 32
+static struct desc descs[DESC_MAX]; /* Descriptors. */
+static size_t desc_cnt;             /* Number of descriptors. */
 
+/* Number of blocks in a magazine, and the number moved to or
+   from the free list at a time. */
+#define MAG_SIZE 8
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Free blocks for one descriptor, owned by one thread. */
+struct magazine
+  {
+    size_t cnt;                         /* Number of blocks. */
+    struct block *blocks[MAG_SIZE];     /* Blocks, last freed last. */
+  };
+
+/* A thread's magazines, one per descriptor. */
+struct magazine_set
+  {
+    struct magazine mags[DESC_MAX];
+  };
+
+/* Cache of magazine sets. */
+static struct slab_cache magazine_cache;
+
+/* Largest block size handled by a descriptor. */
+static size_t max_block_size;
+
+/* Maps (SIZE + 3) / 4 to the smallest descriptor for SIZE bytes. */
+static uint8_t size_to_desc[PGSIZE / 2 / 4 + 1];
+
+/* Statistics. */
+static long long alloc_cnt;     /* Calls to malloc(). */
+static long long request_bytes; /* Bytes requested from malloc(). */
+static long long block_bytes;   /* Bytes in blocks returned. */
+static long long realloc_cnt;   /* Calls to realloc() that resize. */
+static long long in_place_cnt;  /* Resized without moving. */
+static long long copy_bytes;    /* Bytes copied by moving. */
+
+static void *alloc_block (size_t);
+static void *charge_block (void *, void *pc);
+static size_t block_size (void *);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *get_block (struct desc *);
+static void put_block (struct desc *, struct block *);
+static struct magazine *get_magazine (struct desc *);
+static slab_ctor_func init_magazine_set;
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
-  size_t block_size;
-
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  size_t power, i, size;
+
+  for (power = 16; power < PGSIZE / 2; power *= 2)
+    for (i = 0; i < 4; i++)
+      {
+        struct desc *d = &descs[desc_cnt++];
+        ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+        d->block_size = power + i * (power / 4);
+        d->blocks_per_arena = ((PGSIZE - sizeof (struct arena))
+                               / d->block_size);
+        list_init (&d->free_list);
+        mutex_init (&d->lock);
+      }
+  max_block_size = descs[desc_cnt - 1].block_size;
+  slab_cache_init (&magazine_cache, "magazines",
+                   sizeof (struct magazine_set), init_magazine_set);
+
+  /* Every multiple of 4 up to the largest block size maps to the
+     first descriptor big enough for it. */
+  for (size = 0, i = 0; size <= max_block_size; size += 4)
     {
-      struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
+      while (descs[i].block_size < size)
+        i++;
+      size_to_desc[size / 4] = i;
     }
 }
 
@@ -88,26 +171,35 @@ malloc_init (void)
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return charge_block (alloc_block (size), __builtin_return_address (0));
+}
+
+/* Does the work of malloc(), without charging the block to
+   anyone. */
+static void *
+alloc_block (size_t size) 
 {
   struct desc *d;
   struct block *b;
   struct arena *a;
+  struct magazine *m;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
     return NULL;
 
+  alloc_cnt++;
+  request_bytes += size;
+
   /* Find the smallest descriptor that satisfies a SIZE-byte
      request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
+  if (size > max_block_size)
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
+      a = palloc_get_multiple (PAL_TAG (MEM_MALLOC), page_cnt);
       if (a == NULL)
         return NULL;
 
@@ -116,10 +208,53 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      block_bytes += PGSIZE * page_cnt - sizeof *a;
       return a + 1;
     }
+  d = &descs[size_to_desc[(size + 3) / 4]];
+  block_bytes += d->block_size;
 
-  lock_acquire (&d->lock);
+  /* Take a block from this thread's magazine, refilling it if it
+     is empty. */
+  m = get_magazine (d);
+  if (m != NULL)
+    {
+      if (m->cnt == 0)
+        {
+          mutex_acquire (&d->lock);
+          while (m->cnt < MAG_BATCH && (b = get_block (d)) != NULL)
+            m->blocks[m->cnt++] = b;
+          mutex_release (&d->lock);
+          if (m->cnt == 0)
+            return NULL;
+        }
+      return m->blocks[--m->cnt];
+    }
+
+  mutex_acquire (&d->lock);
+  b = get_block (d);
+  mutex_release (&d->lock);
+  return b;
+}
+
+/* Charges BLOCK, if it is nonnull, to the code that will
+   continue at PC, and returns it. */
+static void *
+charge_block (void *block, void *pc) 
+{
+  if (block != NULL)
+    memstat_alloc (MEM_MALLOC, block, block_size (block), pc);
+  return block;
+}
+
+/* Takes a block from D's free list, creating a new arena if
+   necessary, and returns it, or a null pointer if memory is not
+   available.  D's lock must be held. */
+static struct block *
+get_block (struct desc *d) 
+{
+  struct block *b;
+  struct arena *a;
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
@@ -127,12 +262,9 @@ malloc (size_t size)
       size_t i;
 
       /* Allocate a page. */
-      a = palloc_get_page (0);
+      a = palloc_get_page (PAL_TAG (MEM_MALLOC));
       if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+        return NULL; 
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
@@ -149,10 +281,34 @@ malloc (size_t size)
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
   a->free_cnt--;
-  lock_release (&d->lock);
   return b;
 }
 
+/* Returns block B to D's free list, freeing its arena if that
+   leaves the arena unused.  D's lock must be held. */
+static void
+put_block (struct desc *d, struct block *b) 
+{
+  struct arena *a = block_to_arena (b);
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+    }
+}
+
 /* Allocates and return A times B bytes initialized to zeroes.
    Returns a null pointer if memory is not available. */
 void *
@@ -167,7 +323,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = charge_block (alloc_block (size), __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -185,6 +341,34 @@ block_size (void *block)
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
+/* Tries to resize OLD_BLOCK to NEW_SIZE bytes without moving
+   it.  Returns true if successful, false if it must be moved. */
+static bool
+resize_in_place (void *old_block, size_t new_size) 
+{
+  struct arena *a = block_to_arena (old_block);
+
+  if (a->desc != NULL)
+    {
+      /* A small block can stay where it is if NEW_SIZE still
+         falls in its size class, or in a smaller one that would
+         not save much. */
+      return (new_size <= a->desc->block_size
+              && new_size > a->desc->block_size / 2);
+    }
+  else 
+    {
+      /* A big block can stay where it is if its pages can be
+         trimmed or extended to fit NEW_SIZE. */
+      size_t page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+      if (new_size <= max_block_size
+          || !palloc_resize_multiple (a, a->free_cnt, page_cnt))
+        return false;
+      a->free_cnt = page_cnt;
+      return true;
+    }
+}
+
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
    moving it in the process.
    If successful, returns the new block; on failure, returns a
@@ -199,14 +383,29 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block == NULL)
+    return charge_block (alloc_block (new_size),
+                         __builtin_return_address (0));
   else 
     {
-      void *new_block = malloc (new_size);
-      if (old_block != NULL && new_block != NULL)
+      size_t old_size = block_size (old_block);
+      void *new_block;
+
+      realloc_cnt++;
+      if (resize_in_place (old_block, new_size))
+        {
+          in_place_cnt++;
+          memstat_free (MEM_MALLOC, old_block, old_size);
+          return charge_block (old_block, __builtin_return_address (0));
+        }
+
+      new_block = charge_block (alloc_block (new_size),
+                                __builtin_return_address (0));
+      if (new_block != NULL)
         {
-          size_t old_size = block_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
+          copy_bytes += min_size;
           free (old_block);
         }
       return new_block;
@@ -223,36 +422,38 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
-      
+
+      memstat_free (MEM_MALLOC, p, block_size (p));
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
 
+          struct magazine *m;
+
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Put the block in this thread's magazine, first
+             emptying half of it if it is full. */
+          m = get_magazine (d);
+          if (m != NULL)
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
+              if (m->cnt == MAG_SIZE)
                 {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
+                  mutex_acquire (&d->lock);
+                  while (m->cnt > MAG_SIZE - MAG_BATCH)
+                    put_block (d, m->blocks[--m->cnt]);
+                  mutex_release (&d->lock);
                 }
-              palloc_free_page (a);
+              m->blocks[m->cnt++] = b;
+              return;
             }
 
-          lock_release (&d->lock);
+          mutex_acquire (&d->lock);
+          put_block (d, b);
+          mutex_release (&d->lock);
         }
       else
         {
@@ -263,6 +464,74 @@ free (void *p)
     }
 }
 
+/* Prints malloc() statistics: how much memory rounding requests
+   up to block sizes has cost, and how often realloc() had to
+   copy. */
+void
+malloc_print_stats (void) 
+{
+  printf ("Malloc: %lld allocations, %lld of %lld bytes overhead, "
+          "%lld of %lld reallocs in place, %lld bytes copied\n",
+          alloc_cnt, block_bytes - request_bytes, block_bytes,
+          in_place_cnt, realloc_cnt, copy_bytes);
+}
+
+/* Returns the running thread's blocks in its magazines to their
+   descriptors and frees the magazines.  Called when the thread
+   is about to exit. */
+void
+malloc_thread_exit (void) 
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  if (t->magazines == NULL)
+    return;
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      struct magazine *m = &t->magazines->mags[i];
+
+      if (m->cnt > 0)
+        {
+          mutex_acquire (&d->lock);
+          while (m->cnt > 0)
+            put_block (d, m->blocks[--m->cnt]);
+          mutex_release (&d->lock);
+        }
+    }
+  slab_free (&magazine_cache, t->magazines);
+  t->magazines = NULL;
+}
+
+/* Returns the running thread's magazine for D, allocating its
+   magazines if it has none yet, or returns a null pointer if
+   that fails. */
+static struct magazine *
+get_magazine (struct desc *d) 
+{
+  struct thread *t = thread_current ();
+
+  if (t->magazines == NULL)
+    {
+      t->magazines = slab_alloc (&magazine_cache);
+      if (t->magazines == NULL)
+        return NULL;
+    }
+  return &t->magazines->mags[d - descs];
+}
+
+/* Initializes magazine set SET to hold no blocks. */
+static void
+init_magazine_set (void *set_) 
+{
+  struct magazine_set *set = set_;
+  size_t i;
+
+  for (i = 0; i < DESC_MAX; i++)
+    set->mags[i].cnt = 0;
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -0,0 +1,306 @@
+#include "threads/memstat.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+
+/* Kernel memory accounting.
+
+   Every page obtained from palloc_get_multiple() is charged to
+   the tag that the caller gives with PAL_TAG until it is freed.
+   malloc() and slab_alloc() also charge the bytes in each block
+   they hand out to their own tags, so that comparing a tag's
+   bytes to its pages shows how much of the memory held by the
+   allocator is actually in use.  For each tag we keep the
+   current count and its high-water mark.
+
+   With the -memsites option, we also remember the call site of
+   every live malloc() and slab_alloc() block, so that "memstat"
+   can show which code holds the most memory.  Call sites are
+   printed as raw addresses, which the "backtrace" utility
+   translates to function names.  The table of live blocks is
+   allocated at boot and never grows, so once it fills up, new
+   blocks go untracked.
+
+   The pages of dying threads are freed with interrupts off, so
+   all of the data here is protected by disabling interrupts. */
+
+/* Amounts charged to a tag. */
+struct tag_stats
+  {
+    size_t pages, peak_pages;           /* Pages from palloc. */
+    size_t bytes, peak_bytes;           /* Bytes in blocks. */
+  };
+
+static const char *tag_names[MEM_TAG_CNT] =
+  {"misc", "thread", "pagetable", "malloc", "slab", "user"};
+static struct tag_stats tags[MEM_TAG_CNT];
+
+/* -memsites: Track live allocations by call site? */
+bool memstat_track_sites;
+
+/* A call site, identified by the address that the allocator
+   returns to. */
+struct site
+  {
+    void *pc;                           /* Return address, or null. */
+    size_t block_cnt;                   /* Number of live blocks. */
+    size_t bytes;                       /* Bytes in live blocks. */
+  };
+
+/* Call sites, hashed on PC. */
+#define SITE_CNT 128                    /* Must be a power of 2. */
+static struct site sites[SITE_CNT];
+static size_t site_cnt;                 /* Sites in use. */
+
+/* A live block. */
+struct block_rec
+  {
+    void *block;                        /* Block, or null if unused. */
+    size_t site;                        /* Index in sites[]. */
+  };
+
+/* Live blocks, hashed on address with linear probing.  No more
+   than 3/4 of the entries are used, to keep probes short. */
+#define BLOCK_PAGES 16
+#define BLOCK_CNT (BLOCK_PAGES * PGSIZE / sizeof (struct block_rec))
+static struct block_rec *blocks;
+static size_t block_cnt;                /* Entries in use. */
+static size_t untracked_cnt;            /* Allocations left out. */
+
+static void charge (size_t *cnt, size_t *peak, size_t delta);
+static void add_block (void *block, size_t size, void *pc);
+static void remove_block (void *block, size_t size);
+static void print_sites (void);
+
+/* Allocates the table of live blocks, if -memsites was given.
+   Must be called after palloc_init() and before any calls to
+   malloc(). */
+void
+memstat_init (void)
+{
+  if (memstat_track_sites)
+    blocks = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, BLOCK_PAGES);
+}
+
+/* Charges PAGE_CNT newly allocated pages to TAG. */
+void
+memstat_page_alloc (enum mem_tag tag, size_t page_cnt)
+{
+  enum intr_level old_level;
+
+  ASSERT (tag < MEM_TAG_CNT);
+
+  old_level = intr_disable ();
+  charge (&tags[tag].pages, &tags[tag].peak_pages, page_cnt);
+  intr_set_level (old_level);
+}
+
+/* Credits PAGE_CNT freed pages back to TAG. */
+void
+memstat_page_free (enum mem_tag tag, size_t page_cnt)
+{
+  enum intr_level old_level;
+
+  ASSERT (tag < MEM_TAG_CNT);
+
+  old_level = intr_disable ();
+  ASSERT (tags[tag].pages >= page_cnt);
+  tags[tag].pages -= page_cnt;
+  intr_set_level (old_level);
+}
+
+/* Charges BLOCK, a newly allocated block of SIZE bytes, to TAG.
+   PC is the address in the allocator's caller that it will
+   return to. */
+void
+memstat_alloc (enum mem_tag tag, void *block, size_t size, void *pc)
+{
+  enum intr_level old_level;
+
+  ASSERT (tag < MEM_TAG_CNT);
+
+  old_level = intr_disable ();
+  charge (&tags[tag].bytes, &tags[tag].peak_bytes, size);
+  if (blocks != NULL)
+    add_block (block, size, pc);
+  intr_set_level (old_level);
+}
+
+/* Credits BLOCK, a block of SIZE bytes about to be freed, back
+   to TAG. */
+void
+memstat_free (enum mem_tag tag, void *block, size_t size)
+{
+  enum intr_level old_level;
+
+  ASSERT (tag < MEM_TAG_CNT);
+
+  old_level = intr_disable ();
+  ASSERT (tags[tag].bytes >= size);
+  tags[tag].bytes -= size;
+  if (blocks != NULL)
+    remove_block (block, size);
+  intr_set_level (old_level);
+}
+
+/* Prints the memory charged to each tag, the slab caches, and,
+   if -memsites was given, the call sites that hold the most
+   memory. */
+void
+memstat_print (void)
+{
+  int i;
+
+  printf ("Memstat: %-10s %7s %7s %10s %10s\n",
+          "tag", "pages", "peak", "bytes", "peak");
+  for (i = 0; i < MEM_TAG_CNT; i++)
+    {
+      struct tag_stats *t = &tags[i];
+
+      if (t->peak_bytes > 0)
+        printf ("Memstat: %-10s %7zu %7zu %10zu %10zu\n", tag_names[i],
+                t->pages, t->peak_pages, t->bytes, t->peak_bytes);
+      else
+        printf ("Memstat: %-10s %7zu %7zu\n", tag_names[i],
+                t->pages, t->peak_pages);
+    }
+  slab_print_stats ();
+  if (blocks != NULL)
+    print_sites ();
+}
+
+/* Adds DELTA to *CNT, raising *PEAK to match if necessary. */
+static void
+charge (size_t *cnt, size_t *peak, size_t delta)
+{
+  *cnt += delta;
+  if (*cnt > *peak)
+    *peak = *cnt;
+}
+
+/* Returns the index of P's home slot in a hash table of CNT
+   entries, where CNT is a power of 2. */
+static size_t
+home_slot (const void *p, size_t cnt)
+{
+  return hash_int ((int) (uintptr_t) p) & (cnt - 1);
+}
+
+/* Returns the site for PC, adding it if necessary, or a null
+   pointer if the site table is full. */
+static struct site *
+find_site (void *pc)
+{
+  size_t i;
+
+  for (i = home_slot (pc, SITE_CNT); sites[i].pc != NULL;
+       i = (i + 1) & (SITE_CNT - 1))
+    if (sites[i].pc == pc)
+      return &sites[i];
+
+  if (site_cnt >= SITE_CNT * 3 / 4)
+    return NULL;
+  site_cnt++;
+  sites[i].pc = pc;
+  return &sites[i];
+}
+
+/* Records BLOCK, of SIZE bytes, as allocated from PC. */
+static void
+add_block (void *block, size_t size, void *pc)
+{
+  struct site *s;
+  size_t i;
+
+  s = find_site (pc);
+  if (s == NULL || block_cnt >= BLOCK_CNT * 3 / 4)
+    {
+      untracked_cnt++;
+      return;
+    }
+
+  for (i = home_slot (block, BLOCK_CNT); blocks[i].block != NULL;
+       i = (i + 1) & (BLOCK_CNT - 1))
+    continue;
+  blocks[i].block = block;
+  blocks[i].site = s - sites;
+  block_cnt++;
+
+  s->block_cnt++;
+  s->bytes += size;
+}
+
+/* Forgets BLOCK, of SIZE bytes, if it is in the table. */
+static void
+remove_block (void *block, size_t size)
+{
+  struct site *s;
+  size_t i, j;
+
+  for (i = home_slot (block, BLOCK_CNT); blocks[i].block != block;
+       i = (i + 1) & (BLOCK_CNT - 1))
+    if (blocks[i].block == NULL)
+      return;
+
+  s = &sites[blocks[i].site];
+  s->block_cnt--;
+  s->bytes -= size;
+  block_cnt--;
+
+  /* Empty slot I, then move back any later entry in the same run
+     of used slots that could no longer be found past the hole,
+     because its home slot is not between I and its own slot. */
+  blocks[i].block = NULL;
+  for (j = (i + 1) & (BLOCK_CNT - 1); blocks[j].block != NULL;
+       j = (j + 1) & (BLOCK_CNT - 1))
+    {
+      size_t k = home_slot (blocks[j].block, BLOCK_CNT);
+      bool stays = i <= j ? i < k && k <= j : i < k || k <= j;
+
+      if (!stays)
+        {
+          blocks[i] = blocks[j];
+          blocks[j].block = NULL;
+          i = j;
+        }
+    }
+}
+
+/* Prints the call sites with the most bytes in live blocks. */
+static void
+print_sites (void)
+{
+  enum { TOP_CNT = 16 };
+  struct site top[TOP_CNT];
+  size_t top_cnt = 0;
+  enum intr_level old_level;
+  size_t i, j;
+
+  /* Take a sorted snapshot of the biggest sites. */
+  old_level = intr_disable ();
+  for (i = 0; i < SITE_CNT; i++)
+    if (sites[i].block_cnt > 0)
+      {
+        for (j = top_cnt; j > 0 && top[j - 1].bytes < sites[i].bytes; j--)
+          if (j < TOP_CNT)
+            top[j] = top[j - 1];
+        if (j < TOP_CNT)
+          {
+            top[j] = sites[i];
+            if (top_cnt < TOP_CNT)
+              top_cnt++;
+          }
+      }
+  intr_set_level (old_level);
+
+  printf ("Memstat: %zu blocks tracked, %zu untracked; "
+          "largest call sites:\n", block_cnt, untracked_cnt);
+  for (i = 0; i < top_cnt; i++)
+    printf ("Memstat: %10zu bytes in %6zu blocks from %p\n",
+            top[i].bytes, top[i].block_cnt, top[i].pc);
+}
@@ -0,0 +1,29 @@
+#ifndef THREADS_MEMSTAT_H
+#define THREADS_MEMSTAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Subsystems that kernel memory is charged to. */
+enum mem_tag
+  {
+    MEM_MISC,                   /* Anything not tagged otherwise. */
+    MEM_THREAD,                 /* Thread structures and stacks. */
+    MEM_PAGETABLE,              /* Page directories and page tables. */
+    MEM_MALLOC,                 /* malloc() arenas and big blocks. */
+    MEM_SLAB,                   /* Slab cache pages. */
+    MEM_USER,                   /* User pool pages. */
+    MEM_TAG_CNT                 /* Number of tags. */
+  };
+
+/* -memsites: Track live allocations by call site? */
+extern bool memstat_track_sites;
+
+void memstat_init (void);
+void memstat_page_alloc (enum mem_tag, size_t page_cnt);
+void memstat_page_free (enum mem_tag, size_t page_cnt);
+void memstat_alloc (enum mem_tag, void *block, size_t size, void *site);
+void memstat_free (enum mem_tag, void *block, size_t size);
+void memstat_print (void);
+
+#endif /* threads/memstat.h */
@@ -1,12 +1,13 @@
 #include "threads/palloc.h"
-#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,14 +24,72 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a binary buddy system.  A free block
+   of order K is 2**K pages long and starts at a page index that
+   is a multiple of 2**K; its "buddy" is the other half of the
+   block of order K + 1 that contains it.  There is a list of
+   free blocks for each order, threaded through the free pages
+   themselves.  An allocation of N pages splits the smallest
+   large enough free block down to the order just big enough
+   for N and gives back the unused tail pages at once, so it
+   costs O(log n) and wastes nothing.  Freeing a block merges it
+   with its buddy as long as the buddy is free too.
+
+   Almost all requests are for a single page, so each pool keeps
+   a LIFO cache of free pages in front of the buddy system.  The
+   cache is protected by disabling interrupts, which is cheap and
+   also works in the scheduler, where the pages of dying threads
+   are freed with interrupts off.  It is refilled from and drained
+   to the buddy system CACHE_BATCH pages at a time, so the buddy
+   lists and their lock are touched only once per batch.  Pages
+   freed with interrupts off stay in the cache until a later free
+   can take the lock.  A multi-page request that fails flushes
+   the cache and tries again.
+
+   Each allocated page also records the tag, given with PAL_TAG,
+   that it is charged to in the kernel memory statistics (see
+   memstat.c), so that freeing it can credit the right tag. */
+
+/* Number of block orders.  The largest block is 2**(ORDER_CNT-1)
+   pages, far more than physical memory (see start.S). */
+#define ORDER_CNT 16
+
+/* In a pool's block_order[], marks the first page of a free
+   block; the low bits are the order of the block. */
+#define FREE_BLOCK 0x80
+
+/* The cache is drained when it holds more than CACHE_HIGH pages,
+   and CACHE_BATCH pages are moved at a time. */
+#define CACHE_HIGH 32
+#define CACHE_BATCH (CACHE_HIGH / 2)
+
+/* Returned by buddy_alloc() on failure. */
+#define NO_PAGE SIZE_MAX
+
+/* A page in a pool's cache. */
+struct cached_page
+  {
+    struct cached_page *next;           /* Next page in cache. */
+  };
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct mutex lock;                  /* Protects the buddy system. */
+    const char *name;                   /* For statistics. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    uint8_t *block_order;               /* Per-page FREE_BLOCK | order. */
+    uint8_t *page_tag;                  /* Per-page enum mem_tag. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks of each order. */
+    size_t free_cnt;                    /* Free pages in free_lists. */
+
+    /* Free pages, most recently freed first.
+       Protected by disabling interrupts. */
+    struct cached_page *cache;
+    size_t cache_cnt;
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +98,15 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void tag_pages (struct pool *, size_t page_idx, size_t page_cnt,
+                       enum mem_tag);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static bool buddy_extend (struct pool *, size_t page_idx, size_t page_cnt);
+static void *cache_get (struct pool *);
+static void cache_put (struct pool *, void *page);
+static void cache_flush (struct pool *, size_t keep_cnt);
+static void print_pool_stats (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -71,23 +139,36 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum mem_tag tag = flags >> 8;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  pages = page_cnt == 1 ? cache_get (pool) : NULL;
+  if (pages == NULL)
+    {
+      mutex_acquire (&pool->lock);
+      page_idx = buddy_alloc (pool, page_cnt);
+      mutex_release (&pool->lock);
+      if (page_idx == NO_PAGE && pool->cache_cnt > 0)
+        {
+          /* The pages we need may be sitting in the cache. */
+          cache_flush (pool, 0);
+          mutex_acquire (&pool->lock);
+          page_idx = buddy_alloc (pool, page_cnt);
+          mutex_release (&pool->lock);
+        }
+      if (page_idx != NO_PAGE)
+        pages = pool->base + PGSIZE * page_idx;
+    }
 
   if (pages != NULL) 
     {
+      if (tag == MEM_MISC && pool == &user_pool)
+        tag = MEM_USER;
+      tag_pages (pool, pg_no (pages) - pg_no (pool->base), page_cnt, tag);
       if (flags & PAL_ZERO)
         memset (pages, 0, PGSIZE * page_cnt);
     }
@@ -132,13 +213,22 @@ palloc_free_multiple (void *pages, size_t page_cnt)
     NOT_REACHED ();
 
   page_idx = pg_no (pages) - pg_no (pool->base);
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+  ASSERT ((pool->block_order[page_idx] & FREE_BLOCK) == 0);
+  memstat_page_free (pool->page_tag[page_idx], page_cnt);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (page_cnt == 1)
+    cache_put (pool, pages);
+  else
+    {
+      mutex_acquire (&pool->lock);
+      buddy_free (pool, page_idx, page_cnt);
+      mutex_release (&pool->lock);
+    }
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +238,93 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Resizes the group of OLD_CNT pages at PAGES, which must have
+   been obtained from palloc_get_multiple(), to NEW_CNT pages
+   without moving it.  Shrinking always succeeds.  Growing
+   succeeds only if the pages that follow the group are free.
+   Returns true if successful, false otherwise. */
+bool
+palloc_resize_multiple (void *pages, size_t old_cnt, size_t new_cnt)
+{
+  struct pool *pool;
+  size_t page_idx;
+  bool success;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (old_cnt > 0 && new_cnt > 0);
+
+  if (new_cnt < old_cnt)
+    {
+      palloc_free_multiple ((uint8_t *) pages + PGSIZE * new_cnt,
+                            old_cnt - new_cnt);
+      return true;
+    }
+  else if (new_cnt == old_cnt)
+    return true;
+
+  if (page_from_pool (&kernel_pool, pages))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, pages))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+
+  page_idx = pg_no (pages) - pg_no (pool->base) + old_cnt;
+  if (page_idx + (new_cnt - old_cnt) > pool->page_cnt)
+    return false;
+  mutex_acquire (&pool->lock);
+  success = buddy_extend (pool, page_idx, new_cnt - old_cnt);
+  mutex_release (&pool->lock);
+  if (success)
+    tag_pages (pool, page_idx, new_cnt - old_cnt,
+               pool->page_tag[page_idx - 1]);
+  return success;
+}
+
+/* Prints statistics about the page pools, including how
+   fragmented their free memory is: the share of free pages that
+   are not part of the largest free block. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  size_t info_pages;
+  int order;
+
+  /* We'll put the pool's block_order and page_tag arrays at its
+     base.  Calculate the space needed for them and subtract it
+     from the pool's size. */
+  info_pages = DIV_ROUND_UP (page_cnt * 2, PGSIZE);
+  if (info_pages > page_cnt)
+    PANIC ("Not enough memory in %s for block map.", name);
+  page_cnt -= info_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  mutex_init (&p->lock);
+  p->name = name;
+  p->block_order = base;
+  p->page_tag = p->block_order + page_cnt;
+  p->base = base + info_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  memset (p->block_order, 0, page_cnt);
+  for (order = 0; order < ORDER_CNT; order++)
+    list_init (&p->free_lists[order]);
+  p->free_cnt = 0;
+  p->cache = NULL;
+  p->cache_cnt = 0;
+
+  /* Every page starts out free. */
+  buddy_free (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +334,281 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Records that the PAGE_CNT pages starting at PAGE_IDX in POOL,
+   newly allocated, are charged to TAG. */
+static void
+tag_pages (struct pool *pool, size_t page_idx, size_t page_cnt,
+           enum mem_tag tag)
+{
+  memset (pool->page_tag + page_idx, tag, page_cnt);
+  memstat_page_alloc (tag, page_cnt);
+}
+
+/* Returns the list element in free page PAGE_IDX of POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the index of the page that contains ELEM in POOL. */
+static size_t
+elem_page (struct pool *pool, struct list_elem *elem)
+{
+  return pg_no (elem) - pg_no (pool->base);
+}
+
+/* Adds the block of order ORDER at PAGE_IDX to POOL's free
+   lists, without merging it with its buddy. */
+static void
+add_block (struct pool *pool, size_t page_idx, int order)
+{
+  pool->block_order[page_idx] = FREE_BLOCK | order;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+}
+
+/* Removes the free block at PAGE_IDX from POOL's free lists. */
+static void
+remove_block (struct pool *pool, size_t page_idx)
+{
+  pool->block_order[page_idx] = 0;
+  list_remove (block_elem (pool, page_idx));
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages,
+   or ORDER_CNT if there is none. */
+static int
+order_for (size_t page_cnt)
+{
+  int order = 0;
+
+  while (order < ORDER_CNT && ((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first one, or NO_PAGE if there is no free block
+   big enough.  POOL's lock must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  int order = order_for (page_cnt);
+  size_t page_idx;
+  int k;
+
+  for (k = order; k < ORDER_CNT; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k >= ORDER_CNT)
+    return NO_PAGE;
+
+  page_idx = elem_page (pool, list_front (&pool->free_lists[k]));
+  remove_block (pool, page_idx);
+  pool->free_cnt -= (size_t) 1 << k;
+
+  /* Split the block, keeping the lower half each time. */
+  while (k > order)
+    {
+      k--;
+      add_block (pool, page_idx + ((size_t) 1 << k), k);
+      pool->free_cnt += (size_t) 1 << k;
+    }
+
+  /* Give back the pages beyond PAGE_CNT. */
+  if (page_cnt < (size_t) 1 << order)
+    buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+  return page_idx;
+}
+
+/* Frees the block of order ORDER at PAGE_IDX in POOL, merging it
+   with its buddy for as long as the buddy is free as well. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order)
+{
+  pool->free_cnt += (size_t) 1 << order;
+  while (order + 1 < ORDER_CNT)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy_idx + ((size_t) 1 << order) > pool->page_cnt
+          || pool->block_order[buddy_idx] != (FREE_BLOCK | order))
+        break;
+      remove_block (pool, buddy_idx);
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+  add_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   need not form a single block, by freeing the largest aligned
+   blocks that cover them.  POOL's lock must be held, except
+   during initialization. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Allocates the PAGE_CNT pages starting at PAGE_IDX in POOL, if
+   they are all free in the buddy system, and returns true.
+   Otherwise returns false.  The page before PAGE_IDX must be in
+   use, so that PAGE_IDX can only be the first page of a free
+   block, not in the middle of one; the same then goes for the
+   page after each free block.  POOL's lock must be held. */
+static bool
+buddy_extend (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+  size_t idx;
+
+  /* Check that the free blocks cover the range. */
+  for (idx = page_idx; idx < end;
+       idx += (size_t) 1 << (pool->block_order[idx] & ~FREE_BLOCK))
+    if (!(pool->block_order[idx] & FREE_BLOCK))
+      return false;
+
+  /* Take the free blocks, then give back whatever the last one
+     had beyond the end of the range. */
+  for (idx = page_idx; idx < end; )
+    {
+      size_t block_cnt = (size_t) 1 << (pool->block_order[idx] & ~FREE_BLOCK);
+      remove_block (pool, idx);
+      pool->free_cnt -= block_cnt;
+      idx += block_cnt;
+    }
+  if (idx > end)
+    buddy_free (pool, end, idx - end);
+  return true;
+}
+
+/* Returns a free page from POOL's cache, refilling the cache from
+   the buddy system if it is empty.  Returns a null pointer if the
+   pool has no free pages outside the cache. */
+static void *
+cache_get (struct pool *pool) 
+{
+  size_t batch[CACHE_BATCH];
+  size_t batch_cnt, i;
+  enum intr_level old_level;
+  struct cached_page *page;
+
+  old_level = intr_disable ();
+  page = pool->cache;
+  if (page != NULL)
+    {
+      pool->cache = page->next;
+      pool->cache_cnt--;
+    }
+  intr_set_level (old_level);
+  if (page != NULL)
+    return page;
+
+  /* Take a batch of pages from the buddy system. */
+  mutex_acquire (&pool->lock);
+  for (batch_cnt = 0; batch_cnt < CACHE_BATCH; batch_cnt++)
+    {
+      batch[batch_cnt] = buddy_alloc (pool, 1);
+      if (batch[batch_cnt] == NO_PAGE)
+        break;
+    }
+  mutex_release (&pool->lock);
+  if (batch_cnt == 0)
+    return NULL;
+
+  /* Keep the first page for the caller and cache the rest. */
+  for (i = 1; i < batch_cnt; i++)
+    cache_put (pool, pool->base + PGSIZE * batch[i]);
+  return pool->base + PGSIZE * batch[0];
+}
+
+/* Adds free PAGE to POOL's cache.  If that makes the cache too
+   big, and interrupts were on so that we may take the pool's
+   lock, moves a batch of pages back to the buddy system. */
+static void
+cache_put (struct pool *pool, void *page_) 
+{
+  struct cached_page *page = page_;
+  enum intr_level old_level = intr_disable ();
+
+  page->next = pool->cache;
+  pool->cache = page;
+  pool->cache_cnt++;
+  intr_set_level (old_level);
+
+  if (pool->cache_cnt > CACHE_HIGH && old_level == INTR_ON)
+    cache_flush (pool, CACHE_HIGH - CACHE_BATCH);
+}
+
+/* Moves all but KEEP_CNT of the pages in POOL's cache back to
+   the buddy system.  Interrupts must be on. */
+static void
+cache_flush (struct pool *pool, size_t keep_cnt) 
+{
+  struct cached_page *list = NULL;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  while (pool->cache_cnt > keep_cnt)
+    {
+      struct cached_page *page = pool->cache;
+      pool->cache = page->next;
+      pool->cache_cnt--;
+      page->next = list;
+      list = page;
+    }
+  intr_set_level (old_level);
+
+  mutex_acquire (&pool->lock);
+  while (list != NULL)
+    {
+      struct cached_page *page = list;
+      list = page->next;
+      free_block (pool, pg_no (page) - pg_no (pool->base), 0);
+    }
+  mutex_release (&pool->lock);
+}
+
+/* Prints statistics for POOL.  Takes no locks, because it may be
+   called while panicking. */
+static void
+print_pool_stats (struct pool *pool)
+{
+  size_t free_cnt = pool->free_cnt + pool->cache_cnt;
+  size_t largest = 0;
+  int order;
+
+  for (order = ORDER_CNT - 1; order >= 0; order--)
+    if (!list_empty (&pool->free_lists[order]))
+      {
+        largest = (size_t) 1 << order;
+        break;
+      }
+  if (largest == 0 && pool->cache_cnt > 0)
+    largest = 1;
+
+  printf ("Palloc: %s: %zu of %zu pages free, largest free block "
+          "%zu pages, %zu%% fragmented\n",
+          pool->name, free_cnt, pool->page_cnt, largest,
+          free_cnt > 0 ? (free_cnt - largest) * 100 / free_cnt : 0);
+}
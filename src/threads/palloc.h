@@ -1,7 +1,9 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include "threads/memstat.h"
 
 /* How to allocate pages. */
 enum palloc_flags
@@ -11,10 +13,17 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Charges the pages to TAG, an enum mem_tag, in the kernel
+   memory statistics.  Pages from the user pool are charged to
+   MEM_USER and other untagged pages to MEM_MISC. */
+#define PAL_TAG(TAG) ((TAG) << 8)
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_resize_multiple (void *, size_t old_cnt, size_t new_cnt);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -66,6 +66,10 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100             /* 1=global, 0=flushed on CR3 load (PTEs only). */
+#define PTE_COW 0x200           /* 1=copy on write (in PTE_AVL). */
+#define PTE_SWAP 0x400          /* 1=not present, in swap (in PTE_AVL). */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -73,10 +77,21 @@ static inline uint32_t pde_create (uint32_t *pt) {
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the 4 MB of memory starting at kernel
+   virtual address VADDR, which must be 4 MB aligned, as a single
+   large page.  The page is writable and usable only by ring 0
+   code.  Large pages must be enabled with CR4.PSE (see
+   [IA32-v3a] 3.7.3 "Mixing 4-KByte and 4-MByte Pages"). */
+static inline uint32_t pde_create_large (void *vaddr) {
+  ASSERT (((uintptr_t) vaddr & (PTSPAN - 1)) == 0);
+  return vtop (vaddr) | PTE_PS | PTE_P | PTE_W;
+}
+
 /* Returns a pointer to the page table that page directory entry
    PDE, which must "present", points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PTE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
@@ -0,0 +1,242 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/memstat.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator for fixed-size objects.
+
+   malloc() rounds every request up to one of its size classes,
+   four between each pair of powers of 2, so that it may still
+   waste up to 20% or so of each block, and it shares one free
+   list, and one lock, among all the blocks of a class in the
+   kernel.  A subsystem that allocates many objects of one type
+   can instead set up a slab cache for them, which packs objects
+   of exactly that size into pages ("slabs") and has a lock of
+   its own.
+
+   Each slab begins with a header that holds a stack of the
+   indexes of its free objects, followed by the objects
+   themselves.  Keeping the free stack outside the objects means
+   that freeing an object doesn't clobber it, so a cache may have
+   a constructor that is run only once per object, when its slab
+   is created, rather than on every allocation.
+
+   A cache keeps a list of the slabs that have free objects.
+   Full slabs are not tracked at all: slab_free() finds an
+   object's slab by rounding its address down to a page
+   boundary.  One empty slab is kept in reserve, so that a cache
+   whose use hovers around a slab boundary doesn't keep getting
+   and freeing pages.
+
+   Each object handed out is charged to MEM_SLAB in the kernel
+   memory statistics, along with the code that asked for it (see
+   memstat.c). */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Objects are aligned to this many bytes. */
+#define SLAB_ALIGN 8
+
+/* A slab, at the start of a page. */
+struct slab
+  {
+    unsigned magic;                     /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;           /* Owning cache. */
+    struct list_elem elem;              /* Element in partial_slabs. */
+    uint16_t free_cnt;                  /* Number of free objects. */
+    uint16_t free[];                    /* Indexes of free objects. */
+  };
+
+/* List of all caches, for statistics.  Caches are never
+   destroyed.  Protected by disabling interrupts. */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static struct slab *new_slab (struct slab_cache *);
+static void *slab_obj (struct slab_cache *, struct slab *, size_t idx);
+
+/* Initializes cache C for objects of SIZE bytes, named NAME for
+   debugging purposes.  If CTOR is nonnull, it is called to
+   initialize each object when its slab is created. */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t size,
+                 slab_ctor_func *ctor)
+{
+  enum intr_level old_level;
+  size_t n;
+
+  ASSERT (c != NULL);
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, SLAB_ALIGN);
+  c->ctor = ctor;
+  list_init (&c->partial_slabs);
+  c->empty_slab = NULL;
+  c->slab_cnt = 0;
+  c->obj_cnt = 0;
+  lock_init (&c->lock);
+
+  /* Fit as many objects, plus a free stack entry for each, into
+     a page as we can. */
+  n = (PGSIZE - sizeof (struct slab)) / (c->obj_size + sizeof (uint16_t));
+  while (n > 0
+         && (ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t), SLAB_ALIGN)
+             + n * c->obj_size) > PGSIZE)
+    n--;
+  if (n == 0)
+    PANIC ("slab: %zu-byte objects of %s do not fit in a page", size, name);
+  c->objs_per_slab = n;
+  c->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                         SLAB_ALIGN);
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &c->elem);
+  intr_set_level (old_level);
+}
+
+/* Allocates and returns an object from cache C, or returns a
+   null pointer if memory is not available.  If C has a
+   constructor, the object is in constructed state; otherwise its
+   contents are garbage. */
+void *
+slab_alloc (struct slab_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial_slabs))
+    s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+  else
+    {
+      if (c->empty_slab != NULL)
+        {
+          s = c->empty_slab;
+          c->empty_slab = NULL;
+        }
+      else
+        {
+          s = new_slab (c);
+          if (s == NULL)
+            {
+              lock_release (&c->lock);
+              return NULL;
+            }
+        }
+      list_push_front (&c->partial_slabs, &s->elem);
+    }
+
+  obj = slab_obj (c, s, s->free[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    list_remove (&s->elem);
+  c->obj_cnt++;
+  lock_release (&c->lock);
+
+  memstat_alloc (MEM_SLAB, obj, c->obj_size, __builtin_return_address (0));
+  return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C.
+   Does nothing if OBJ is a null pointer. */
+void
+slab_free (struct slab_cache *c, void *obj)
+{
+  struct slab *s;
+  size_t ofs;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ofs = pg_ofs (obj) - c->obj_ofs;
+  ASSERT (ofs % c->obj_size == 0);
+  memstat_free (MEM_SLAB, obj, c->obj_size);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     that would destroy its constructed state. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+  if (s->free_cnt == 0)
+    list_push_front (&c->partial_slabs, &s->elem);
+  s->free[s->free_cnt++] = ofs / c->obj_size;
+  c->obj_cnt--;
+  if (s->free_cnt == c->objs_per_slab)
+    {
+      /* The slab is now empty.  Keep it as the spare, or give it
+         back if we already have one. */
+      list_remove (&s->elem);
+      if (c->empty_slab == NULL)
+        c->empty_slab = s;
+      else
+        {
+          palloc_free_page (s);
+          c->slab_cnt--;
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Prints the number of objects in use and the number of slabs
+   in each cache.  Takes no locks, like the other statistics
+   printers. */
+void
+slab_print_stats (void) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      printf ("Slab: %s: %zu of %zu %zu-byte objects in use\n",
+              c->name, c->obj_cnt, c->slab_cnt * c->objs_per_slab,
+              c->obj_size);
+    }
+}
+
+/* Creates and returns a new slab for cache C with all of its
+   objects free and constructed, or returns a null pointer if
+   memory is not available. */
+static struct slab *
+new_slab (struct slab_cache *c)
+{
+  struct slab *s = palloc_get_page (PAL_TAG (MEM_SLAB));
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  c->slab_cnt++;
+
+  /* Hand out objects in address order. */
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      s->free[i] = c->objs_per_slab - i - 1;
+      if (c->ctor != NULL)
+        c->ctor (slab_obj (c, s, i));
+    }
+  return s;
+}
+
+/* Returns the object with index IDX in slab S of cache C. */
+static void *
+slab_obj (struct slab_cache *c, struct slab *s, size_t idx)
+{
+  ASSERT (idx < c->objs_per_slab);
+  return (uint8_t *) s + c->obj_ofs + idx * c->obj_size;
+}
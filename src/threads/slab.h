@@ -0,0 +1,36 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Initializes a newly created object.  Called once per object
+   when the page that holds it is added to a cache, not on every
+   allocation, so objects must be freed in their constructed
+   state. */
+typedef void slab_ctor_func (void *obj);
+
+/* A cache of objects of a single size. */
+struct slab_cache
+  {
+    const char *name;                   /* For debugging. */
+    size_t obj_size;                    /* Object size, rounded up. */
+    size_t objs_per_slab;               /* Objects in each slab. */
+    size_t obj_ofs;                     /* Offset of first object in slab. */
+    slab_ctor_func *ctor;               /* Constructor, or null. */
+    struct list partial_slabs;          /* Slabs with free objects. */
+    struct slab *empty_slab;            /* A spare empty slab, or null. */
+    size_t slab_cnt;                    /* Number of slabs. */
+    size_t obj_cnt;                     /* Number of objects in use. */
+    struct lock lock;                   /* Protects the above. */
+    struct list_elem elem;              /* Element in list of all caches. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      slab_ctor_func *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
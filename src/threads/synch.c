@@ -29,9 +29,43 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* A wait on a semaphore with a time limit. */
+struct timed_wait
+  {
+    struct thread *thread;      /* Waiting thread. */
+    struct alarm alarm;         /* Fires when time is up. */
+    bool timed_out;             /* Did the alarm fire? */
+  };
+
+/* Next value for a waiting thread's wait_seq. */
+static unsigned next_wait_seq;
+
+static void add_waiter (struct semaphore *);
+static void remove_waiter (struct thread *);
+static struct thread *pop_waiter (struct semaphore *);
+static int queue_priority (const struct thread *);
+static bool preempts (const struct thread *);
+static void donate_priority (struct lock *);
+static bool timed_down (struct semaphore *, struct lock *, int64_t timeout);
+static alarm_func wait_timed_out;
+
+/* In a mutex's `owner', set while the mutex is contended. */
+#define MUTEX_CONTENDED 1
+
+/* Number of times to check a mutex held by a thread running on
+   another CPU before going to sleep. */
+#define MUTEX_SPIN_MAX 1000
+
+static bool compare_and_swap (volatile uintptr_t *,
+                              uintptr_t old, uintptr_t new);
+static bool mutex_spin (struct mutex *);
+static void mutex_acquire_slow (struct mutex *);
+static void mutex_release_slow (struct mutex *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -47,7 +81,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, thread_waiter_greater, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -67,44 +101,125 @@ sema_down (struct semaphore *sema)
 
   old_level = intr_disable ();
   while (sema->value == 0) 
-  {
-    list_push_back (&sema->waiters, &thread_current()->elem);
-    thread_block ();
-  }
+    {
+      add_waiter (sema);
+      thread_block ();
+    }
   sema->value--;
   intr_set_level (old_level);
 }
 
+/* Downs SEMA, which must be LOCK's semaphore, as sema_down().
+   While the running thread waits, it donates its priority to
+   LOCK's holder, and on down the chain of locks that the holder
+   is waiting for, as described at donate_priority(). */
 void
 sema_down_with_donation (struct semaphore *sema, struct lock *lock)
 {
+  struct thread *cur = thread_current ();
   enum intr_level old_level;
 
   ASSERT (sema != NULL);
-  ASSERT (!intr_context());
+  ASSERT (lock != NULL && sema == &lock->semaphore);
+  ASSERT (!intr_context ());
 
-  thread_current()->lock_to_acquire = lock;
+  old_level = intr_disable ();
+  cur->lock_to_acquire = lock;
+  while (sema->value == 0)
+    {
+      add_waiter (sema);
+      donate_priority (lock);
+      thread_block ();
+    }
+  sema->value--;
+  cur->lock_to_acquire = NULL;
+  list_push_back (&cur->acquired_locks_list, &lock->lockelem);
+  intr_set_level (old_level);
+}
 
-  old_level = intr_disable();
+/* Down or "P" operation on a semaphore, but waits no more than
+   TIMEOUT timer ticks for SEMA's value to become positive.
+   Returns true if SEMA was decremented, false if time ran out.
 
-  struct thread *lock_holder = lock->holder;
+   This function may sleep, so it must not be called within an
+   interrupt handler.  This function may be called with
+   interrupts disabled, but if it sleeps then the next scheduled
+   thread will probably turn interrupts back on. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t timeout)
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  success = timed_down (sema, NULL, timeout);
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/* Waits up to TIMEOUT ticks to down SEMA, as sema_down_timeout().
+   If LOCK is nonnull, SEMA is LOCK's semaphore, and the running
+   thread donates its priority to LOCK's holder while it waits.
+   Interrupts must be off.
+
+   The thread waits among SEMA's waiters, as in sema_down(), and
+   also sets an alarm for the time limit.  Whichever comes first
+   wakes it up: sema_up() removes it from the waiters before
+   unblocking it, and the alarm does the same if it is still
+   there.  Interrupts stay off from when the thread wakes up
+   until it cancels the alarm, so the alarm cannot fire after
+   that. */
+static bool
+timed_down (struct semaphore *sema, struct lock *lock, int64_t timeout)
+{
+  struct thread *cur = thread_current ();
+  struct timed_wait w;
+  bool armed = false;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  w.thread = cur;
+  w.timed_out = false;
   while (sema->value == 0)
-  {
-    list_push_back (&sema->waiters, &thread_current()->elem);
-    //ASSERT(list_check(&sema->waiters));
-    if (thread_current()->eff_priority > lock_holder->eff_priority) {
-      thread_set_eff_priority(lock_holder, thread_current()->eff_priority);
+    {
+      if (w.timed_out || timeout <= 0)
+        return false;
+      if (!armed)
+        {
+          alarm_init (&w.alarm, wait_timed_out, &w);
+          alarm_set (&w.alarm, timer_ticks () + timeout);
+          armed = true;
+        }
+
+      add_waiter (sema);
+      if (lock != NULL)
+        donate_priority (lock);
+      thread_block ();
     }
-    thread_block();
-  }
+  if (armed)
+    alarm_cancel (&w.alarm);
   sema->value--;
 
-  thread_current()->lock_to_acquire = NULL;
-  if (!list_contains_elem (&thread_current()->acquired_locks_list, &lock->lockelem))
-    list_push_back (&thread_current()->acquired_locks_list, &lock->lockelem);
-  ASSERT(list_check(&thread_current()->acquired_locks_list));
+  return true;
+}
 
-  intr_set_level (old_level);
+/* Alarm function for timed_down(): wakes up the waiting thread
+   W_, if it is still waiting. */
+static void
+wait_timed_out (void *w_)
+{
+  struct timed_wait *w = w_;
+
+  if (w->thread->status == THREAD_BLOCKED)
+    {
+      remove_waiter (w->thread);
+      w->timed_out = true;
+      thread_unblock (w->thread);
+    }
 }
 
 /* Down or "P" operation on a semaphore, but only if the
@@ -141,62 +256,145 @@ void
 sema_up (struct semaphore *sema) 
 {
   enum intr_level old_level;
-  bool yield_on_return = false;
+  bool yield = false;
+
   ASSERT (sema != NULL);
   
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)) {
-    struct list_elem *highest_priority_elem;
-    highest_priority_elem = list_min (&sema->waiters, 
-                                      thread_priority_greater, NULL);
-    list_remove(highest_priority_elem);
-
-    struct thread *next = list_entry (highest_priority_elem,
-                                      struct thread, elem);
-    if (thread_current()->eff_priority < next->eff_priority)
-      yield_on_return = true;
-    thread_unblock (next);
-  }
+  if (!heap_empty (&sema->waiters))
+    {
+      struct thread *next = pop_waiter (sema);
+
+      yield = preempts (next);
+      thread_unblock (next);
+    }
   sema->value++;
   intr_set_level (old_level);
 
-  if (yield_on_return)
-    thread_yield();
+  if (yield)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
 }
 
+/* Ups SEMA, which must be LOCK's semaphore, as sema_up(), for
+   the running thread, which is releasing LOCK.  Takes back any
+   priority donated to the running thread through LOCK. */
 void
 sema_up_with_donation (struct semaphore *sema, struct lock *lock)
 {
   enum intr_level old_level;
-  bool yield_on_return = false;
+  bool yield = false;
+
   ASSERT (sema != NULL);
+  ASSERT (lock != NULL && sema == &lock->semaphore);
+  ASSERT (!intr_context ());
   
   old_level = intr_disable ();
   list_remove (&lock->lockelem);
-  if (!list_empty (&sema->waiters)) {
-    struct thread *next = list_entry (list_min (&sema->waiters, 
-                                thread_priority_greater, NULL),
-                                struct thread, elem);
-    list_remove(&next->elem);
-    //ASSERT(list_check(&sema->waiters));
-    struct thread *cur = thread_current();
-    //ASSERT(list_check(&cur->acquired_locks_list));
-
-    /* Current thread's priority may decrease in this case*/
-    if (cur->eff_priority == next->eff_priority) {
-      thread_update_eff_priority(cur); 
-    }
+  if (!heap_empty (&sema->waiters))
+    {
+      struct thread *next = pop_waiter (sema);
 
-    if (cur->eff_priority < next->eff_priority)
-      yield_on_return = true; 
-    thread_unblock (next);
-  }
+      thread_update_eff_priority (thread_current ());
+      yield = preempts (next);
+      thread_unblock (next);
+    }
   sema->value++;
   intr_set_level (old_level);
 
-  if (yield_on_return)
-    thread_yield();
+  if (yield)
+    thread_yield ();
+}
+
+/* Adds the running thread to SEMA's waiters.  Interrupts must be
+   off. */
+static void
+add_waiter (struct semaphore *sema)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (cur->waiting_in == NULL);
+
+  cur->wait_seq = next_wait_seq++;
+  cur->waiting_in = &sema->waiters;
+  heap_insert (&sema->waiters, &cur->waitelem);
+}
+
+/* Removes T from the waiters of the semaphore it is waiting on.
+   Interrupts must be off. */
+static void
+remove_waiter (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->waiting_in != NULL);
+
+  heap_remove (t->waiting_in, &t->waitelem);
+  t->waiting_in = NULL;
 }
+
+/* Removes and returns the waiter on SEMA that should be woken up
+   first, which is the one with the highest priority, or the one
+   that has waited longest among those with the same priority.
+   SEMA must have a waiter.  Interrupts must be off. */
+static struct thread *
+pop_waiter (struct semaphore *sema)
+{
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t = heap_entry (heap_pop (&sema->waiters), struct thread, waitelem);
+  t->waiting_in = NULL;
+  return t;
+}
+
+/* Returns the priority that T is scheduled at: its base
+   priority under the MLFQS, its effective priority otherwise. */
+static int
+queue_priority (const struct thread *t)
+{
+  return thread_mlfqs ? t->priority : t->eff_priority;
+}
+
+/* Returns true if T, which has just been woken up, should run in
+   place of the running thread. */
+static bool
+preempts (const struct thread *t)
+{
+  return queue_priority (t) > queue_priority (thread_current ());
+}
+
+/* Donates the running thread's effective priority to the holder
+   of LOCK, which the running thread is waiting for.  If the
+   holder is itself waiting for a lock, the donation passes on to
+   that lock's holder, and so on down the chain, stopping at the
+   first holder whose effective priority is already at least as
+   high.  Each step moves one holder within the run queue or the
+   waiters heap that it is on, so the whole donation takes time
+   proportional to the length of the chain.  Interrupts must be
+   off. */
+static void
+donate_priority (struct lock *lock)
+{
+  int priority = thread_current ()->eff_priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (lock != NULL && lock->holder != NULL
+         && lock->holder->eff_priority < priority)
+    {
+      struct thread *holder = lock->holder;
+
+      thread_set_eff_priority (holder, priority);
+      lock = holder->lock_to_acquire;
+    }
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -281,7 +479,45 @@ lock_acquire (struct lock *lock)
   lock->holder = thread_current();
 }
 
-/* Tries to acquires LOCK and returns true if successful or false
+/* Acquires LOCK as lock_acquire(), but sleeps no more than
+   TIMEOUT timer ticks waiting for it.  Returns true if the lock
+   was acquired, false if time ran out, in which case any
+   priority donated to the holder while waiting is taken back.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+lock_acquire_timeout (struct lock *lock, int64_t timeout)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!lock_held_by_current_thread (lock));
+
+  old_level = intr_disable ();
+  if (!thread_mlfqs)
+    {
+      cur->lock_to_acquire = lock;
+      success = timed_down (&lock->semaphore, lock, timeout);
+      cur->lock_to_acquire = NULL;
+      if (success)
+        list_push_back (&cur->acquired_locks_list, &lock->lockelem);
+      else if (lock->holder != NULL)
+        thread_update_eff_priority (lock->holder);
+    }
+  else
+    success = timed_down (&lock->semaphore, NULL, timeout);
+  if (success)
+    lock->holder = cur;
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/* Tries to acquire LOCK and returns true if successful or false
    on failure.  The lock must not already be held by the current
    thread.
 
@@ -331,11 +567,227 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/* Initializes mutex M, which is initially free.
+
+   A mutex is in one of two modes.  While it is uncontended,
+   M->owner is its holder, or 0 if it is free, and M->lock is not
+   in use: it has no holder and its semaphore is 0.  A thread
+   that finds M held switches it to contended mode by setting
+   MUTEX_CONTENDED in M->owner and lending M->lock to M's holder,
+   as if the holder had acquired it.  Then the thread waits for
+   M->lock with lock_acquire(), donating its priority as usual.
+   Because MUTEX_CONTENDED is set, the holder's compare-and-swap
+   in mutex_release() fails, so it releases M->lock instead, and
+   whichever thread acquires M->lock next becomes M's holder.
+   When the holder releases M and no thread is waiting for it,
+   it takes M->lock back and returns M to uncontended mode.
+
+   Switching modes, lending and taking back M->lock, and counting
+   M's waiters all happen with interrupts off and M->guard held,
+   so that a holder releasing M on one CPU cannot take M->lock
+   back between another CPU marking M contended and counting
+   itself as a waiter.  M->guard is dropped before sleeping in
+   lock_acquire() and before waking a waiter in lock_release().
+   Those two still rely, like every lock and semaphore, on
+   disabling interrupts for their own consistency. */
+void
+mutex_init (struct mutex *m)
+{
+  ASSERT (m != NULL);
+
+  m->owner = 0;
+  spinlock_init (&m->guard);
+  m->waiter_cnt = 0;
+  lock_init (&m->lock);
+  sema_init (&m->lock.semaphore, 0);
+}
+
+/* Acquires mutex M, sleeping until it becomes available if
+   necessary.  M must not already be held by the current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler.  This function may be called with
+   interrupts disabled, but interrupts will be turned back on if
+   we need to sleep. */
+void
+mutex_acquire (struct mutex *m)
+{
+  ASSERT (m != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!mutex_held_by_current_thread (m));
+
+  if (!compare_and_swap (&m->owner, 0, (uintptr_t) thread_current ()))
+    mutex_acquire_slow (m);
+}
+
+/* Tries to acquire mutex M and returns true if successful or
+   false on failure.  M must not already be held by the current
+   thread.
+
+   This function will not sleep, so it may be called within an
+   interrupt handler. */
+bool
+mutex_try_acquire (struct mutex *m)
+{
+  ASSERT (m != NULL);
+  ASSERT (!mutex_held_by_current_thread (m));
+
+  return compare_and_swap (&m->owner, 0, (uintptr_t) thread_current ());
+}
+
+/* Releases mutex M, which must be held by the current thread. */
+void
+mutex_release (struct mutex *m)
+{
+  ASSERT (m != NULL);
+  ASSERT (mutex_held_by_current_thread (m));
+
+  if (!compare_and_swap (&m->owner, (uintptr_t) thread_current (), 0))
+    mutex_release_slow (m);
+}
+
+/* Returns true if the current thread holds mutex M, false
+   otherwise. */
+bool
+mutex_held_by_current_thread (const struct mutex *m)
+{
+  ASSERT (m != NULL);
+
+  return (m->owner & ~MUTEX_CONTENDED) == (uintptr_t) thread_current ();
+}
+
+/* Atomically sets *P to NEW if *P is OLD.  Returns true if *P
+   was set, false otherwise.  See [IA32-v2a] "CMPXCHG". */
+static bool
+compare_and_swap (volatile uintptr_t *p, uintptr_t old, uintptr_t new)
+{
+  uintptr_t prev;
+
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (*p)
+                : "r" (new), "0" (old)
+                : "memory");
+  return prev == old;
+}
+
+/* Spins while mutex M is held by a thread that is running on
+   another CPU, in the hope that it will release M soon, checking
+   no more than MUTEX_SPIN_MAX times.  Returns true if M was
+   acquired, false if the caller should sleep instead.  Never
+   spins on a uniprocessor, where M's holder cannot be running. */
+static bool
+mutex_spin (struct mutex *m)
+{
+  uintptr_t cur = (uintptr_t) thread_current ();
+  int i;
+
+  for (i = 0; i < MUTEX_SPIN_MAX; i++)
+    {
+      uintptr_t owner = m->owner;
+
+      if (owner == 0)
+        {
+          if (compare_and_swap (&m->owner, 0, cur))
+            return true;
+        }
+      else if ((owner & MUTEX_CONTENDED)
+               || !thread_is_running ((struct thread *) owner))
+        return false;
+      asm volatile ("pause");
+    }
+  return false;
+}
+
+/* Acquires mutex M, which the fast path in mutex_acquire() found
+   held, as described at mutex_init(). */
+static void
+mutex_acquire_slow (struct mutex *m)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (mutex_spin (m))
+    return;
+
+  old_level = intr_disable ();
+  spinlock_acquire (&m->guard);
+  for (;;)
+    {
+      uintptr_t owner = m->owner;
+
+      if (owner == 0)
+        {
+          /* Released in the meantime. */
+          if (compare_and_swap (&m->owner, 0, (uintptr_t) cur))
+            break;
+        }
+      else if (owner & MUTEX_CONTENDED)
+        {
+          /* Once we are counted, the holder will hand M over
+             through M->lock instead of taking it back, even if it
+             releases M before we get to sleep. */
+          m->waiter_cnt++;
+          spinlock_release (&m->guard);
+          lock_acquire (&m->lock);
+          spinlock_acquire (&m->guard);
+          m->waiter_cnt--;
+          m->owner = (uintptr_t) cur | MUTEX_CONTENDED;
+          break;
+        }
+      else if (compare_and_swap (&m->owner, owner, owner | MUTEX_CONTENDED))
+        {
+          /* Lend M->lock to M's holder, so that waiting for it
+             donates priority to the holder. */
+          struct thread *holder = (struct thread *) owner;
+
+          m->lock.holder = holder;
+          if (!thread_mlfqs)
+            list_push_back (&holder->acquired_locks_list,
+                            &m->lock.lockelem);
+        }
+    }
+  spinlock_release (&m->guard);
+  intr_set_level (old_level);
+}
+
+/* Releases mutex M, which is contended, as described at
+   mutex_init(). */
+static void
+mutex_release_slow (struct mutex *m)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  spinlock_acquire (&m->guard);
+  ASSERT (m->owner & MUTEX_CONTENDED);
+  if (m->waiter_cnt == 0)
+    {
+      /* Take back M->lock.  Nothing can have been donated
+         through it, since no thread is waiting for it. */
+      m->lock.holder = NULL;
+      if (!thread_mlfqs)
+        list_remove (&m->lock.lockelem);
+      m->owner = 0;
+      spinlock_release (&m->guard);
+    }
+  else
+    {
+      /* Hand M over to whichever thread next acquires M->lock.
+         Until then, MUTEX_CONTENDED alone keeps M from looking
+         free. */
+      m->owner = MUTEX_CONTENDED;
+      spinlock_release (&m->guard);
+      lock_release (&m->lock);
+    }
+  intr_set_level (old_level);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -380,13 +832,53 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  list_insert_ordered (&cond->waiters, &waiter.elem,
-                       thread_priority_greater, NULL);
+  waiter.thread = thread_current ();
+  list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
+/* Waits for COND to be signaled, as cond_wait(), but for no more
+   than TIMEOUT timer ticks.  LOCK is reacquired before returning
+   either way, however long that takes.  Returns true if COND was
+   signaled, false if time ran out.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+cond_wait_timeout (struct condition *cond, struct lock *lock,
+                   int64_t timeout)
+{
+  struct semaphore_elem waiter;
+  bool signaled;
+
+  ASSERT (cond != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+
+  sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
+  list_push_back (&cond->waiters, &waiter.elem);
+  lock_release (lock);
+  signaled = sema_down_timeout (&waiter.semaphore, timeout);
+  lock_acquire (lock);
+
+  /* Time ran out, but a signal may have come in before we got
+     LOCK back.  If not, we are still on COND's list, and since we
+     hold LOCK no one else can take us off it. */
+  if (!signaled)
+    {
+      if (sema_try_down (&waiter.semaphore))
+        signaled = true;
+      else
+        list_remove (&waiter.elem);
+    }
+
+  return signaled;
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -403,8 +895,25 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct semaphore_elem *first = NULL;
+      struct list_elem *e;
+
+      /* Waiters' priorities can change while they wait, so rather
+         than keep the list sorted, find the highest-priority
+         waiter, the one that has waited longest among equals. */
+      for (e = list_begin (&cond->waiters); e != list_end (&cond->waiters);
+           e = list_next (e))
+        {
+          struct semaphore_elem *w = list_entry (e, struct semaphore_elem,
+                                                 elem);
+          if (first == NULL
+              || queue_priority (w->thread) > queue_priority (first->thread))
+            first = w;
+        }
+      list_remove (&first->elem);
+      sema_up (&first->semaphore);
+    }
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -422,3 +931,83 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes spin lock LOCK, which is initially free. */
+void
+spinlock_init (struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+
+  lock->locked = 0;
+}
+
+/* Acquires LOCK, busy-waiting until it is free if necessary.
+   Interrupts must be off, and must stay off until LOCK is
+   released. */
+void
+spinlock_acquire (struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (;;)
+    {
+      int was_locked = 1;
+
+      /* XCHG with a memory operand is atomic and a full memory
+         barrier.  See [IA32-v2b] "XCHG". */
+      asm volatile ("xchgl %0, %1"
+                    : "+r" (was_locked), "+m" (lock->locked)
+                    : : "memory");
+      if (!was_locked)
+        return;
+
+      /* Wait with plain reads, which do not take the cache line
+         away from the holder, until the lock looks free. */
+      while (lock->locked)
+        asm volatile ("pause");
+    }
+}
+
+/* Tries to acquire LOCK and returns true if successful or false
+   on failure.  Never spins.  Interrupts must be off, and if the
+   lock is acquired must stay off until it is released.
+
+   Taking a second spin lock this way cannot deadlock, whatever
+   order other CPUs take the same locks in. */
+bool
+spinlock_try_acquire (struct spinlock *lock)
+{
+  int was_locked = 1;
+
+  ASSERT (lock != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  asm volatile ("xchgl %0, %1"
+                : "+r" (was_locked), "+m" (lock->locked)
+                : : "memory");
+  return !was_locked;
+}
+
+/* Releases LOCK, which must be held. */
+void
+spinlock_release (struct spinlock *lock)
+{
+  ASSERT (spinlock_held (lock));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* x86 does not reorder stores with earlier loads or stores, so
+     a compiler barrier suffices to keep the critical section's
+     accesses before the release. */
+  barrier ();
+  lock->locked = 0;
+}
+
+/* Returns true if LOCK is held, by this CPU or any other. */
+bool
+spinlock_held (const struct spinlock *lock)
+{
+  ASSERT (lock != NULL);
+
+  return lock->locked != 0;
+}
@@ -1,8 +1,10 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 struct lock;
 
@@ -10,12 +12,14 @@ struct lock;
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, highest
+                                   priority first. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
 void sema_down_with_donation (struct semaphore *, struct lock *);
+bool sema_down_timeout (struct semaphore *, int64_t timeout);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_up_with_donation (struct semaphore *, struct lock *);
@@ -31,6 +35,7 @@ struct lock
 
 void lock_init (struct lock *);
 void lock_acquire (struct lock *);
+bool lock_acquire_timeout (struct lock *, int64_t timeout);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
@@ -43,9 +48,54 @@ struct condition
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
+bool cond_wait_timeout (struct condition *, struct lock *, int64_t timeout);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Spin lock.
+
+   A spin lock protects data that more than one CPU may touch.
+   Waiting for one busy-waits instead of sleeping, so it may be
+   used where sleeping is not allowed, such as in the scheduler
+   and in interrupt handlers.  It must only be held with
+   interrupts off: otherwise an interrupt handler on the holder's
+   own CPU could spin on it forever. */
+struct spinlock
+  {
+    volatile int locked;        /* Nonzero while held. */
+  };
+
+void spinlock_init (struct spinlock *);
+void spinlock_acquire (struct spinlock *);
+bool spinlock_try_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+bool spinlock_held (const struct spinlock *);
+
+/* Adaptive mutex.
+
+   A mutex is a lock that is cheap to take when it is free:
+   acquiring or releasing a free mutex is a single atomic
+   compare-and-swap, with no need to disable interrupts.  Only a
+   thread that finds the mutex held falls back on the blocking
+   and priority donation of an ordinary lock, and first, if the
+   holder is running on another CPU, it spins for a while in the
+   hope that the holder will soon release it.  A mutex suits
+   short critical sections that are entered often.  It cannot be
+   used with a condition variable. */
+struct mutex
+  {
+    volatile uintptr_t owner;   /* Holder | MUTEX_CONTENDED, or 0. */
+    struct spinlock guard;      /* Serializes the slow paths. */
+    unsigned waiter_cnt;        /* Threads waiting for `lock'. */
+    struct lock lock;           /* Used only under contention. */
+  };
+
+void mutex_init (struct mutex *);
+void mutex_acquire (struct mutex *);
+bool mutex_try_acquire (struct mutex *);
+void mutex_release (struct mutex *);
+bool mutex_held_by_current_thread (const struct mutex *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
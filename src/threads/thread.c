@@ -4,9 +4,12 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
+#include "threads/kstack.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
@@ -17,30 +20,79 @@
 #endif
 
 /* Random value for struct thread's `magic' member.
-   Used to detect stack overflow.  See the big comment at the top
-   of thread.h for details. */
+   Used to detect corruption of struct thread.  See the big
+   comment at the top of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list[PRI_MAX + 1];
+/* A CPU, with the scheduler state that is kept per CPU.
+
+   Each CPU has its own ready queues, protected by its own
+   rq_lock, so that CPUs do not contend to schedule.  A thread
+   that becomes ready goes on the queues of the CPU it last ran
+   on.  Bit I of ready_mask is set if ready_list[I] is nonempty,
+   so that the highest priority with a ready thread can be found
+   in constant time; there are exactly 64 priorities, one per
+   bit.  The rest of the members are only touched by the CPU they
+   belong to, with interrupts off, so they need no lock.
+
+   Only the bootstrap processor runs for now.  Much of the rest
+   of the kernel still relies on disabling interrupts for mutual
+   exclusion, which does not exclude other CPUs, so starting the
+   application processors has to wait until those sections use
+   spin locks too. */
+struct cpu
+  {
+    int id;                             /* CPU number, from 0. */
+    struct thread *cur;                 /* Running thread. */
+    struct thread *idle;                /* Idle thread. */
+
+    /* Threads in THREAD_READY state, that is, threads that are
+       ready to run on this CPU but not actually running. */
+    struct spinlock rq_lock;            /* Protects the members below. */
+    struct list ready_list[PRI_MAX + 1];
+    uint64_t ready_mask;                /* Nonempty ready_list[] elements. */
+    int ready_cnt;                      /* Number of ready threads. */
+
+    /* Statistics. */
+    unsigned thread_ticks;              /* Timer ticks since last yield. */
+    long long idle_ticks;               /* Timer ticks spent idle. */
+    long long kernel_ticks;             /* Timer ticks in kernel threads. */
+    long long user_ticks;               /* Timer ticks in user programs. */
+  };
+
+/* CPUs. */
+#define CPU_MAX 8
+static struct cpu cpus[CPU_MAX];
+static int cpu_cnt;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* Idle thread. */
-struct thread *idle_thread;
-
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
+/* Migrations of threads that have exited, for
+   thread_print_stats(). */
+static long long exited_migrate_cnt;
+
 /* Lock used by allocate_tid(). */
-static struct lock tid_lock;
+static struct mutex tid_lock;
 
 /* load avg */
 fixed_point_t load_avg;
 
+/* Once a second, the MLFQS decays every thread's recent_cpu by a
+   coefficient that depends on load_avg.  Only the running thread
+   and ready threads, whose priorities matter right away, are
+   decayed on time.  A blocked thread catches up when it is
+   unblocked, by replaying the decays it missed, for which we keep
+   the last DECAY_HISTORY coefficients.  decay_coef[E %
+   DECAY_HISTORY] takes recent_cpu from epoch E - 1 to epoch E. */
+#define DECAY_HISTORY 64
+static int decay_epoch;                 /* Current epoch (seconds). */
+static fixed_point_t decay_coef[DECAY_HISTORY];
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -49,14 +101,9 @@ struct kernel_thread_frame
     void *aux;                  /* Auxiliary data for function. */
   };
 
-/* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
-
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+#define BALANCE_INTERVAL 20     /* # of timer ticks between balancing. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
@@ -65,12 +112,24 @@ bool thread_mlfqs;
 
 static void kernel_thread (thread_func *, void *aux);
 
+static void cpu_init (struct cpu *, int id);
+static struct cpu *this_cpu (void);
+static void lock_all_cpus (void);
+static void unlock_all_cpus (void);
+static struct cpu *busiest_cpu (struct cpu *);
+static struct thread *steal (struct cpu *victim, struct cpu *);
+static void balance (struct cpu *);
+
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *, int priority);
+static int ready_max (struct cpu *);
+static void requeue_waiter (struct thread *);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
@@ -80,7 +139,8 @@ static tid_t allocate_tid (void);
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the bootstrap processor's run queue and the
+   tid lock.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -91,17 +151,20 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  uint32_t *esp;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  int i;
-  for (i = 0; i <= PRI_MAX; i++) {
-    list_init (&ready_list[i]);
-  }
+  cpu_cnt = 1;
+  cpu_init (&cpus[0], 0);
+  mutex_init (&tid_lock);
   list_init (&all_list);
 
-  /* Set up a thread structure for the running thread. */
-  initial_thread = running_thread ();
+  /* Set up a thread structure for the running thread.  The
+     loader put its stack in a page of its own, growing down from
+     the top, so the structure goes at the bottom of that page. */
+  asm ("mov %%esp, %0" : "=g" (esp));
+  initial_thread = cpus[0].cur = pg_round_down (esp);
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
@@ -122,7 +185,7 @@ thread_start (void)
   /* Start preemptive thread scheduling. */
   intr_enable ();
 
-  /* Wait for the idle thread to initialize idle_thread. */
+  /* Wait for the idle thread to make itself this CPU's. */
   sema_down (&idle_started);
 }
 
@@ -131,29 +194,85 @@ thread_start (void)
 void
 thread_tick (void) 
 {
+  struct cpu *c = this_cpu ();
   struct thread *t = thread_current ();
 
   /* Update statistics. */
-  if (t == idle_thread)
-    idle_ticks++;
+  if (t == c->idle)
+    c->idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    c->user_ticks++;
 #endif
   else
-    kernel_ticks++;
+    c->kernel_ticks++;
 
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++c->thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
+
+  /* Even out the CPUs' run queues now and then. */
+  if ((c->idle_ticks + c->kernel_ticks + c->user_ticks)
+      % BALANCE_INTERVAL == 0)
+    balance (c);
 }
 
-/* Prints thread statistics. */
+/* Accounts for CNT timer ticks that passed while this CPU was
+   idle with its periodic tick stopped. */
+void
+thread_tick_idle (int64_t cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (cnt >= 0);
+
+  this_cpu ()->idle_ticks += cnt;
+}
+
+/* Returns true if this CPU has nothing to do: it is running its
+   idle thread and no thread is ready to run on it.  Interrupts
+   must be off. */
+bool
+thread_cpu_idle (void)
+{
+  struct cpu *c = this_cpu ();
+  bool idle;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  spinlock_acquire (&c->rq_lock);
+  idle = c->cur == c->idle && c->ready_cnt == 0;
+  spinlock_release (&c->rq_lock);
+  return idle;
+}
+
+/* Prints thread statistics, totaled over all CPUs. */
 void
 thread_print_stats (void) 
 {
+  long long idle_ticks = 0, kernel_ticks = 0, user_ticks = 0;
+  long long migrate_cnt;
+  enum intr_level old_level;
+  struct list_elem *e;
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      idle_ticks += cpus[i].idle_ticks;
+      kernel_ticks += cpus[i].kernel_ticks;
+      user_ticks += cpus[i].user_ticks;
+    }
+
+  /* Count the moves of exited and live threads alike. */
+  old_level = intr_disable ();
+  migrate_cnt = exited_migrate_cnt;
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    migrate_cnt += list_entry (e, struct thread, allelem)->migrate_cnt;
+  intr_set_level (old_level);
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld migrations between CPUs\n", migrate_cnt);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -179,14 +298,16 @@ thread_create (const char *name, int priority,
   struct kernel_thread_frame *kf;
   struct switch_entry_frame *ef;
   struct switch_threads_frame *sf;
+  void *stack_top;
   tid_t tid;
 
   ASSERT (function != NULL);
 
-  /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
-  if (t == NULL)
+  /* Allocate thread, at the top of a new kernel stack. */
+  stack_top = kstack_alloc ();
+  if (stack_top == NULL)
     return TID_ERROR;
+  t = (struct thread *) stack_top - 1;
 
   /* Initialize thread. */
   init_thread (t, name, priority);
@@ -240,13 +361,14 @@ thread_block (void)
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
+  spinlock_acquire (&this_cpu ()->rq_lock);
   thread_current ()->status = THREAD_BLOCKED;
   schedule ();
 }
 
-/* Transitions a blocked thread T to the ready-to-run state.
-   This is an error if T is not blocked.  (Use thread_yield() to
-   make the running thread ready.)
+/* Transitions a blocked thread T to the ready-to-run state, on
+   the CPU it last ran on.  This is an error if T is not blocked.
+   (Use thread_yield() to make the running thread ready.)
 
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
@@ -261,12 +383,12 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  if (thread_mlfqs) {
-    list_push_back (&ready_list[t->priority], &t->elem);
-  } else {
-    list_push_back (&ready_list[t->eff_priority], &t->elem);
-  }
+  if (thread_mlfqs)
+    calculate_recent_cpu (t, NULL);
+  spinlock_acquire (&t->cpu->rq_lock);
+  ready_push (t);
   t->status = THREAD_READY;
+  spinlock_release (&t->cpu->rq_lock);
   intr_set_level (old_level);
 }
 
@@ -286,10 +408,10 @@ thread_current (void)
   struct thread *t = running_thread ();
   
   /* Make sure T is really a thread.
-     If either of these assertions fire, then your thread may
-     have overflowed its stack.  Each thread has less than 4 kB
-     of stack, so a few big automatic arrays or moderate
-     recursion can cause stack overflow. */
+     If either of these assertions fire, then something has
+     overwritten the running thread's `struct thread'.  (A thread
+     that overflows its kernel stack runs into the guard page
+     below it instead.) */
   ASSERT (is_thread (t));
   ASSERT (t->status == THREAD_RUNNING);
 
@@ -313,12 +435,15 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  malloc_thread_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
+  exited_migrate_cnt += thread_current ()->migrate_cnt;
   list_remove (&thread_current()->allelem);
+  spinlock_acquire (&this_cpu ()->rq_lock);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -335,19 +460,36 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-    if (thread_mlfqs) {
-      list_push_back (&ready_list[cur->priority], &cur->elem);
-    }
-    else {
-      list_push_back (&ready_list[cur->eff_priority], &cur->elem);
-    }
-  }
+  spinlock_acquire (&cur->cpu->rq_lock);
+  if (cur != cur->cpu->idle)
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Returns true if T is a CPU's idle thread. */
+bool
+thread_is_idle (const struct thread *t)
+{
+  return t == t->cpu->idle;
+}
+
+/* Returns true if T is the running thread on some CPU.  T is
+   only compared with each CPU's running thread, never followed,
+   so it may point to a thread that has since exited.  The answer
+   may be out of date by the time the caller sees it. */
+bool
+thread_is_running (const struct thread *t)
+{
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].cur == t)
+      return true;
+  return false;
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -365,72 +507,126 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
+/* Returns true if thread A, waiting on a semaphore, should be
+   woken up before thread B, because it has a higher priority or
+   has waited longer at the same priority.  Waiters are ordered
+   by base priority under the MLFQS, by effective priority
+   otherwise. */
 bool
-thread_priority_greater(const struct list_elem *a,
-                        const struct list_elem *b,
-                        void *aux UNUSED)
+thread_waiter_greater (const struct heap_elem *a_,
+                       const struct heap_elem *b_,
+                       void *aux UNUSED)
 {
-  const struct thread *t_a = list_entry(a, struct thread, elem);
-  const struct thread *t_b = list_entry(b, struct thread, elem);
-  if (thread_mlfqs)
-    return t_a->priority > t_b->priority;
-  else
-    return t_a->eff_priority > t_b->eff_priority;
+  const struct thread *a = heap_entry (a_, struct thread, waitelem);
+  const struct thread *b = heap_entry (b_, struct thread, waitelem);
+  int a_priority = thread_mlfqs ? a->priority : a->eff_priority;
+  int b_priority = thread_mlfqs ? b->priority : b->eff_priority;
+
+  if (a_priority != b_priority)
+    return a_priority > b_priority;
+  return (int) (a->wait_seq - b->wait_seq) < 0;
 }
 
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority (int new_priority) 
 {  
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int old_eff_priority;
+
   if (thread_mlfqs)
-  {
     return;
-  }
-  struct thread *cur = thread_current();
-  if (new_priority == cur->priority)
-    return;
-  int old_priority = cur->priority;
+
+  old_level = intr_disable ();
+  old_eff_priority = cur->eff_priority;
   cur->priority = new_priority;
-  thread_set_eff_priority(cur, new_priority);
-  if (cur->eff_priority < old_priority)
-    thread_yield();
+  thread_update_eff_priority (cur);
+  intr_set_level (old_level);
+
+  if (cur->eff_priority < old_eff_priority)
+    thread_yield ();
 }
 
-/* Get effective priority of a thread. */
+/* Recomputes T's effective priority after its base priority
+   changes or it releases or stops waiting for a lock.  T's
+   effective priority is the higher of its base priority and the
+   effective priority of the first waiter for each lock it holds,
+   which takes one look per lock, since waiters are kept in
+   priority order.  If that changes T's effective priority, and T
+   is itself waiting for a lock, the holder of that lock is
+   recomputed in turn, and so on down the chain.  Interrupts must
+   be off. */
 void
 thread_update_eff_priority (struct thread *t)
 {
-  ASSERT(!thread_mlfqs);
-  int new_eff_priority = t->priority;
-  struct list_elem *e;
-  for (e = list_begin (&t->acquired_locks_list);
-       e != list_end (&t->acquired_locks_list);
-       e = list_next (e)) {
-    printf("get inside loop of update_eff_priority.\n");
-    struct lock *l = list_entry (e, struct lock, lockelem);
-    struct thread *thread = list_entry (list_min (&l->semaphore.waiters, 
-                                  thread_priority_greater, NULL),
-                                  struct thread, elem);
-    if (new_eff_priority < thread->eff_priority)
-      new_eff_priority = thread->eff_priority;
-  }
-  thread_set_eff_priority(t, new_eff_priority); 
+  ASSERT (!thread_mlfqs);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (t != NULL)
+    {
+      int eff_priority = t->priority;
+      struct list_elem *e;
+
+      for (e = list_begin (&t->acquired_locks_list);
+           e != list_end (&t->acquired_locks_list); e = list_next (e))
+        {
+          struct lock *l = list_entry (e, struct lock, lockelem);
+          struct thread *waiter;
+
+          if (heap_empty (&l->semaphore.waiters))
+            continue;
+          waiter = heap_entry (heap_top (&l->semaphore.waiters),
+                               struct thread, waitelem);
+          if (waiter->eff_priority > eff_priority)
+            eff_priority = waiter->eff_priority;
+        }
+      if (eff_priority == t->eff_priority)
+        break;
+
+      thread_set_eff_priority (t, eff_priority);
+      t = t->lock_to_acquire != NULL ? t->lock_to_acquire->holder : NULL;
+    }
 }
 
-/* Set effective priority of a thread. */
+/* Sets T's effective priority to EFF_PRIORITY.  If T is ready or
+   waiting on a semaphore, moves it to the matching place in its
+   run queue or among the semaphore's waiters.  Interrupts must be
+   off. */
 void
 thread_set_eff_priority (struct thread *t, int eff_priority)
 {
+  ASSERT (!thread_mlfqs);
+  ASSERT (intr_get_level () == INTR_OFF);
+
   if (eff_priority == t->eff_priority)
     return;
-  t->eff_priority = eff_priority;
+
+  if (t->status == THREAD_READY)
+    {
+      struct cpu *c = t->cpu;
+
+      spinlock_acquire (&c->rq_lock);
+      ready_remove (t, t->eff_priority);
+      t->eff_priority = eff_priority;
+      ready_push (t);
+      spinlock_release (&c->rq_lock);
+    }
+  else
+    {
+      t->eff_priority = eff_priority;
+      requeue_waiter (t);
+    }
 }
 
-/* Returns the current thread's priority. */
+/* Returns the current thread's priority.  In the presence of
+   priority donation, returns the higher (donated) priority. */
 int
 thread_get_priority (void) 
 {
-  return thread_current ()->priority;
+  struct thread *cur = thread_current ();
+
+  return thread_mlfqs ? cur->priority : cur->eff_priority;
 }
 
 /* Sets the current thread's nice value to NICE. */
@@ -475,16 +671,16 @@ thread_get_recent_cpu (void)
 
    The idle thread is initially put on the ready list by
    thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
+   point it makes itself its CPU's idle thread, "up"s the
+   semaphore passed to it to enable thread_start() to continue,
+   and immediately blocks.  After that, the idle thread never appears in the
    ready list.  It is returned by next_thread_to_run() as a
    special case when the ready list is empty. */
 static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  this_cpu ()->idle = thread_current ();
   sema_up (idle_started);
 
   for (;;) 
@@ -524,14 +720,52 @@ kernel_thread (thread_func *function, void *aux)
 struct thread *
 running_thread (void) 
 {
-  uint32_t *esp;
+  return this_cpu ()->cur;
+}
 
-  /* Copy the CPU's stack pointer into `esp', and then round that
-     down to the start of a page.  Because `struct thread' is
-     always at the beginning of a page and the stack pointer is
-     somewhere in the middle, this locates the curent thread. */
-  asm ("mov %%esp, %0" : "=g" (esp));
-  return pg_round_down (esp);
+/* Initializes C as CPU number ID, with empty ready queues. */
+static void
+cpu_init (struct cpu *c, int id)
+{
+  int i;
+
+  memset (c, 0, sizeof *c);
+  c->id = id;
+  spinlock_init (&c->rq_lock);
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&c->ready_list[i]);
+}
+
+/* Returns the CPU we are running on.  Once the application
+   processors run, this must find out which CPU is asking, from
+   its local APIC ID or a per-CPU segment.  Until then it is
+   always the bootstrap processor. */
+static struct cpu *
+this_cpu (void)
+{
+  return &cpus[0];
+}
+
+/* Acquires every CPU's run queue lock, always in order of CPU
+   number so that two CPUs doing this cannot deadlock.
+   Interrupts must be off. */
+static void
+lock_all_cpus (void)
+{
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    spinlock_acquire (&cpus[i].rq_lock);
+}
+
+/* Releases every CPU's run queue lock. */
+static void
+unlock_all_cpus (void)
+{
+  int i;
+
+  for (i = cpu_cnt - 1; i >= 0; i--)
+    spinlock_release (&cpus[i].rq_lock);
 }
 
 /* Returns true if T appears to point to a valid thread. */
@@ -555,8 +789,9 @@ init_thread (struct thread *t, const char *name, int priority)
   memset (t, 0, sizeof *t);
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
-  t->stack = (uint8_t *) t + PGSIZE;
+  t->stack = (uint8_t *) t;
   t->magic = THREAD_MAGIC;
+  t->cpu = this_cpu ();
   if (thread_mlfqs) {
     if (t == initial_thread) {
       t->nice = 0;
@@ -566,6 +801,7 @@ init_thread (struct thread *t, const char *name, int priority)
       t->nice = thread_current ()->nice;
       t->recent_cpu = thread_current ()->recent_cpu;
     }
+    t->decay_epoch = decay_epoch;
     calculate_priority_mlfqs (t, NULL);
   }
   else
@@ -594,21 +830,194 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/* Chooses and returns the next thread to be scheduled on this
+   CPU, whose run queue lock must be held.  Should return a
+   thread from the run queue, unless the run queue is empty.  (If
+   the running thread can continue running, then it will be in
+   the run queue.)  If the run queue is empty, steal a thread
+   from the busiest CPU, and if there is none to steal, return
+   the CPU's idle thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
+  struct cpu *c = this_cpu ();
+  int priority = ready_max (c);
+  struct thread *t;
+
+  if (priority < PRI_MIN)
+    {
+      struct cpu *victim = busiest_cpu (c);
+
+      if (victim == NULL || !spinlock_try_acquire (&victim->rq_lock))
+        return c->idle;
+      t = steal (victim, c);
+      spinlock_release (&victim->rq_lock);
+      if (t == NULL)
+        return c->idle;
+      priority = ready_max (c);
+    }
+  t = list_entry (list_front (&c->ready_list[priority]), struct thread, elem);
+  ready_remove (t, priority);
+  return t;
+}
+
+/* Load balancing.
+
+   A CPU whose run queue runs dry steals a thread from the CPU
+   with the most ready threads instead of going idle.  Every
+   BALANCE_INTERVAL ticks, each CPU also pulls a thread from the
+   busiest CPU if that one has at least two more ready threads
+   than it does.
+
+   The thread taken is the highest-priority one, in terms of the
+   priority that places it in the run queue, so that it is the
+   effective priority, including donations, that counts, or the
+   MLFQS priority under the MLFQS.  Among threads of that
+   priority it is the one that has waited longest, whose cache
+   footprint on its old CPU is most likely gone already.
+
+   The victim's run queue lock is only ever tried, never waited
+   for, so two CPUs stealing from each other cannot deadlock. */
+
+/* Returns the CPU other than C with the most ready threads, or a
+   null pointer if no other CPU has any.  The counts are read
+   without locking, so the answer is only a hint. */
+static struct cpu *
+busiest_cpu (struct cpu *c)
+{
+  struct cpu *busiest = NULL;
   int i;
-  for (i = PRI_MAX; i >= PRI_MIN; i--) {
-    if (list_empty(&ready_list[i]))
-      continue;
-    return list_entry (list_pop_front (&ready_list[i]), struct thread, elem);
-  }
-  return idle_thread;
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (&cpus[i] != c && cpus[i].ready_cnt > 0
+        && (busiest == NULL || cpus[i].ready_cnt > busiest->ready_cnt))
+      busiest = &cpus[i];
+  return busiest;
+}
+
+/* Moves the thread that VICTIM should give up to the run queue
+   of C and returns it, or returns a null pointer if VICTIM has
+   no ready threads.  Both CPUs' run queue locks must be held. */
+static struct thread *
+steal (struct cpu *victim, struct cpu *c)
+{
+  int priority = ready_max (victim);
+  struct thread *t;
+
+  ASSERT (victim != c);
+  ASSERT (spinlock_held (&victim->rq_lock));
+  ASSERT (spinlock_held (&c->rq_lock));
+
+  if (priority < PRI_MIN)
+    return NULL;
+  t = list_entry (list_front (&victim->ready_list[priority]),
+                  struct thread, elem);
+  ready_remove (t, priority);
+  t->cpu = c;
+  t->migrate_cnt++;
+  ready_push (t);
+  return t;
+}
+
+/* Periodic balancing for CPU C, called from the timer interrupt.
+   Pulls a thread from the busiest CPU if it is busier enough,
+   and yields to the thread if it should run before the running
+   thread. */
+static void
+balance (struct cpu *c)
+{
+  struct cpu *victim = busiest_cpu (c);
+  struct thread *t = NULL;
+
+  ASSERT (intr_context ());
+
+  if (victim == NULL)
+    return;
+
+  spinlock_acquire (&c->rq_lock);
+  if (victim->ready_cnt - c->ready_cnt >= 2
+      && spinlock_try_acquire (&victim->rq_lock))
+    {
+      t = steal (victim, c);
+      spinlock_release (&victim->rq_lock);
+    }
+  if (t != NULL
+      && (c->cur == c->idle
+          || (thread_mlfqs
+              ? t->priority > c->cur->priority
+              : t->eff_priority > c->cur->eff_priority)))
+    intr_yield_on_return ();
+  spinlock_release (&c->rq_lock);
+}
+
+/* Adds T to the ready queue of its CPU for its priority: its
+   base priority under the MLFQS, its effective priority
+   otherwise.  The CPU's run queue lock must be held. */
+static void
+ready_push (struct thread *t)
+{
+  struct cpu *c = t->cpu;
+  int priority = thread_mlfqs ? t->priority : t->eff_priority;
+
+  ASSERT (spinlock_held (&c->rq_lock));
+  ASSERT (priority >= PRI_MIN && priority <= PRI_MAX);
+
+  list_push_back (&c->ready_list[priority], &t->elem);
+  c->ready_mask |= (uint64_t) 1 << priority;
+  c->ready_cnt++;
+}
+
+/* Removes T from ready_list[PRIORITY] of its CPU.  The CPU's run
+   queue lock must be held. */
+static void
+ready_remove (struct thread *t, int priority)
+{
+  struct cpu *c = t->cpu;
+
+  ASSERT (spinlock_held (&c->rq_lock));
+
+  list_remove (&t->elem);
+  if (list_empty (&c->ready_list[priority]))
+    c->ready_mask &= ~((uint64_t) 1 << priority);
+  c->ready_cnt--;
+}
+
+/* Moves T to its place among the waiters of the semaphore it is
+   waiting on, if any, after a change in its priority. */
+static void
+requeue_waiter (struct thread *t)
+{
+  if (t->waiting_in != NULL)
+    {
+      heap_remove (t->waiting_in, &t->waitelem);
+      heap_insert (t->waiting_in, &t->waitelem);
+    }
+}
+
+/* Returns the highest priority that has a ready thread on CPU C,
+   or -1 if there are no ready threads.  C's run queue lock must
+   be held. */
+static int
+ready_max (struct cpu *c)
+{
+  uint32_t hi = c->ready_mask >> 32;
+  uint32_t lo = c->ready_mask;
+  uint32_t bit;
+
+  /* BSR finds the most significant set bit of a nonzero 32-bit
+     word.  See [IA32-v2a] "BSR--Bit Scan Reverse". */
+  if (hi != 0)
+    {
+      asm ("bsrl %1, %0" : "=r" (bit) : "rm" (hi));
+      return bit + 32;
+    }
+  else if (lo != 0)
+    {
+      asm ("bsrl %1, %0" : "=r" (bit) : "rm" (lo));
+      return bit;
+    }
+  else
+    return -1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -616,10 +1025,11 @@ next_thread_to_run (void)
 
    At this function's invocation, we just switched from thread
    PREV, the new thread is already running, and interrupts are
-   still disabled.  This function is normally invoked by
-   thread_schedule() as its final action before returning, but
-   the first time a thread is scheduled it is called by
-   switch_entry() (see switch.S).
+   still disabled.  The CPU's run queue lock is still held, too,
+   from before the switch; this function releases it.  This
+   function is normally invoked by thread_schedule() as its final
+   action before returning, but the first time a thread is
+   scheduled it is called by switch_entry() (see switch.S).
 
    It's not safe to call printf() until the thread switch is
    complete.  In practice that means that printf()s should be
@@ -630,15 +1040,25 @@ next_thread_to_run (void)
 void
 thread_schedule_tail (struct thread *prev)
 {
+  struct cpu *c = this_cpu ();
   struct thread *cur = running_thread ();
 
   ASSERT (intr_get_level () == INTR_OFF);
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  cur->cpu = c;
+  spinlock_release (&c->rq_lock);
+
+  /* Leaving the idle thread means the CPU has work again.  The
+     interrupt that gave it the work may have switched threads
+     straight from its handler, so catch every way out of the
+     idle thread here. */
+  if (prev != NULL && thread_is_idle (prev))
+    timer_idle_exit ();
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  c->thread_ticks = 0;
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -649,17 +1069,20 @@ thread_schedule_tail (struct thread *prev)
      thread.  This must happen late so that thread_exit() doesn't
      pull out the rug under itself.  (We don't free
      initial_thread because its memory was not obtained via
-     palloc().) */
+     kstack_alloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
   {
     ASSERT (prev != cur);
-    palloc_free_page (prev);
+    kstack_free (prev + 1);
   }
 }
 
-/* Schedules a new process.  At entry, interrupts must be off and
-   the running process's state must have been changed from
-   running to some other state.  This function finds another
+/* Schedules a new process.  At entry, interrupts must be off,
+   the CPU's run queue lock must be held, and the running
+   process's state must have been changed from running to some
+   other state.  The lock stays held across the switch, so that
+   no other CPU can pick up the running process until it is off
+   this CPU's stack.  This function finds another
    thread to run and switches to it.
 
    It's not safe to call printf() until thread_schedule_tail()
@@ -672,11 +1095,15 @@ schedule (void)
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (spinlock_held (&this_cpu ()->rq_lock));
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      this_cpu ()->cur = next;
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -687,9 +1114,9 @@ allocate_tid (void)
   static tid_t next_tid = 1;
   tid_t tid;
 
-  lock_acquire (&tid_lock);
+  mutex_acquire (&tid_lock);
   tid = next_tid++;
-  lock_release (&tid_lock);
+  mutex_release (&tid_lock);
 
   return tid;
 }
@@ -716,48 +1143,106 @@ void calculate_priority_mlfqs (struct thread *t, void *aux UNUSED)
   }
   if (t->priority != old_priority && t->status == THREAD_READY && t != thread_current ())
   {
-    list_remove (&t->elem);
-    list_push_back (&ready_list[t->priority], &t->elem);
+    /* Caller holds T's CPU's run queue lock. */
+    ready_remove (t, old_priority);
+    ready_push (t);
   }
+  else if (t->priority != old_priority)
+    requeue_waiter (t);
 }
 
 void calculate_load_avg ()
 {
   ASSERT (thread_mlfqs);
   //load_avg = (59/60)*load_avg + (1/60)*ready_threads
-  int i, ready_threads=0;
-  for (i = 0; i < PRI_MAX + 1; i++)
-  {
-    ready_threads += list_size (&ready_list[i]);
-  }
-  if (thread_current () != idle_thread)
+  int ready_threads = 0;
+  int i;
+  lock_all_cpus ();
+  for (i = 0; i < cpu_cnt; i++)
   {
-    ready_threads++;
+    ready_threads += cpus[i].ready_cnt;
+    if (cpus[i].cur != cpus[i].idle)
+    {
+      ready_threads++;
+    }
   }
+  unlock_all_cpus ();
   load_avg = fix_add (fix_mul (fix_frac (59, 60), load_avg),
                       fix_frac (ready_threads, 60));
 }
 
+/* Brings T's recent_cpu up to date by applying the decays it has
+   missed since it was last brought up to date, and recalculates
+   its priority if anything changed. */
 void calculate_recent_cpu (struct thread *t, void *aux UNUSED)
 {
   ASSERT (thread_mlfqs);
-  //recent_cpu = (2 * load_avg) / (2 * load_avg + 1) * recent_cpu + nice
-  fixed_point_t coef = fix_scale (load_avg, 2);
-  coef = fix_div (coef, fix_add (coef, fix_int (1)));
-  t->recent_cpu = fix_add (fix_mul (coef, t->recent_cpu), fix_int(t->nice));
+  ASSERT (decay_epoch - t->decay_epoch <= DECAY_HISTORY);
+  if (t->decay_epoch == decay_epoch)
+    return;
+  while (t->decay_epoch != decay_epoch)
+  {
+    fixed_point_t coef = decay_coef[++t->decay_epoch % DECAY_HISTORY];
+    t->recent_cpu = fix_add (fix_mul (coef, t->recent_cpu), fix_int(t->nice));
+  }
+  calculate_priority_mlfqs (t, NULL);
 }
 
-bool need_yield ()
+/* Starts a new decay epoch, once a second, and applies it to the
+   running thread and the ready threads.  Blocked threads catch up
+   when they are unblocked, except that before their oldest missed
+   coefficient would be overwritten, every thread catches up. */
+void decay_recent_cpu (void)
 {
   ASSERT (thread_mlfqs);
-  int i;
-  struct thread *t = thread_current();
-  for (i = PRI_MAX; i > t->priority; i--)
+  ASSERT (intr_get_level () == INTR_OFF);
+  //recent_cpu = (2 * load_avg) / (2 * load_avg + 1) * recent_cpu + nice
+  fixed_point_t coef = fix_scale (load_avg, 2);
+  coef = fix_div (coef, fix_add (coef, fix_int (1)));
+  decay_coef[++decay_epoch % DECAY_HISTORY] = coef;
+
+  if (decay_epoch % DECAY_HISTORY == 0)
   {
-    if (!list_empty (&ready_list[i]))
+    lock_all_cpus ();
+    thread_foreach (calculate_recent_cpu, NULL);
+    unlock_all_cpus ();
+    return;
+  }
+
+  int c, i;
+  for (c = 0; c < cpu_cnt; c++)
+  {
+    struct cpu *cpu = &cpus[c];
+    spinlock_acquire (&cpu->rq_lock);
+    calculate_recent_cpu (cpu->cur, NULL);
+    for (i = PRI_MIN; i <= PRI_MAX; i++)
     {
-      return true;
+      struct list_elem *e, *next;
+      for (e = list_begin (&cpu->ready_list[i]);
+           e != list_end (&cpu->ready_list[i]); e = next)
+      {
+        /* Recalculating the priority may move the thread to
+           another queue, or to the end of this one. */
+        next = list_next (e);
+        calculate_recent_cpu (list_entry (e, struct thread, elem), NULL);
+      }
     }
+    spinlock_release (&cpu->rq_lock);
   }
-  return false;
+}
+
+bool need_yield ()
+{
+  ASSERT (thread_mlfqs);
+  struct cpu *c;
+  enum intr_level old_level;
+  bool yield;
+
+  old_level = intr_disable ();
+  c = this_cpu ();
+  spinlock_acquire (&c->rq_lock);
+  yield = ready_max (c) > thread_current ()->priority;
+  spinlock_release (&c->rq_lock);
+  intr_set_level (old_level);
+  return yield;
 }
@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/fixed-point.h"
@@ -30,13 +31,19 @@ typedef int tid_t;
 
 /* A kernel thread or user process.
 
-   Each thread structure is stored in its own 4 kB page.  The
-   thread structure itself sits at the very bottom of the page
-   (at offset 0).  The rest of the page is reserved for the
-   thread's kernel stack, which grows downward from the top of
-   the page (at offset 4 kB).  Here's an illustration:
+   Each thread structure is stored at the very top of the
+   thread's kernel stack, which grows downward from just below
+   it.  The stack is KSTACK_PAGES pages long (8 kB by default),
+   and the page below it is left unmapped as a guard (see
+   kstack.c).  Here's an illustration:
 
-        4 kB +---------------------------------+
+             +---------------------------------+
+             |              magic              |
+             |                :                |
+             |                :                |
+             |               name              |
+             |              status             |
+             +---------------------------------+
              |          kernel stack           |
              |                |                |
              |                |                |
@@ -44,46 +51,39 @@ typedef int tid_t;
              |         grows downward          |
              |                                 |
              |                                 |
-             |                                 |
-             |                                 |
-             |                                 |
-             |                                 |
-             |                                 |
-             |                                 |
              +---------------------------------+
-             |              magic              |
-             |                :                |
-             |                :                |
-             |               name              |
-             |              status             |
-        0 kB +---------------------------------+
+             |           guard page            |
+             |           (unmapped)            |
+             +---------------------------------+
 
    The upshot of this is twofold:
 
       1. First, `struct thread' must not be allowed to grow too
-         big.  If it does, then there will not be enough room for
-         the kernel stack.  Our base `struct thread' is only a
-         few bytes in size.  It probably should stay well under 1
-         kB.
+         big.  It takes room away from the kernel stack.  Our
+         base `struct thread' is only a few bytes in size.  It
+         probably should stay well under 1 kB.
 
       2. Second, kernel stacks must not be allowed to grow too
-         large.  If a stack overflows, it will corrupt the thread
-         state.  Thus, kernel functions should not allocate large
+         large.  A stack that overflows runs into the guard page.
+         With a user program kernel, that causes a double fault
+         that is reported as a probable kernel stack overflow
+         (see userprog/tss.c); otherwise the machine resets.
+         Thus, kernel functions should not allocate large
          structures or arrays as non-static local variables.  Use
          dynamic allocation with malloc() or palloc_get_page()
          instead.
 
-   The first symptom of either of these problems will probably be
-   an assertion failure in thread_current(), which checks that
-   the `magic' member of the running thread's `struct thread' is
-   set to THREAD_MAGIC.  Stack overflow will normally change this
-   value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+   The running thread is found through a pointer kept by the
+   scheduler, not from the stack pointer, so thread_current()
+   works on any stack.  The initial thread is the exception to
+   the layout above: it runs on the stack that the loader set up,
+   in a single page with its `struct thread' at the bottom. */
+/* The `elem' member is an element in a run queue (thread.c), and
+   `waitelem' is an element in the heap of threads waiting on a
+   semaphore (synch.c).  A thread is in at most one of them at a
+   time: only a thread in the ready state is on a run queue,
+   whereas only a thread in the blocked state waits on a
+   semaphore. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -94,24 +94,40 @@ struct thread
     int priority;                       /* Priority. */
     int eff_priority;                   /* Effective priority. */
     struct list_elem allelem;           /* List element for all threads list. */
-    struct list_elem sleepelem;         /* List element for the sleeping list */
-    int64_t wake_up_time;               /* The time this thread will wake up */
     struct list acquired_locks_list;    /* Locks acquired by this thread. */
     struct lock *lock_to_acquire;       /* The lock this thread is waiting on. */
 
     int nice;                           /* Nice value */
     fixed_point_t recent_cpu;                     /* Recent cpu value */
+    int decay_epoch;                    /* Last decay applied to recent_cpu. */
+    struct cpu *cpu;                    /* CPU last run on. */
+    unsigned migrate_cnt;               /* Times moved to another CPU. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct heap_elem waitelem;          /* Semaphore waiters element. */
+    struct heap *waiting_in;            /* Waiters heap, if waiting. */
+    unsigned wait_seq;                  /* Orders equal-priority waiters. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
 #endif
 
+    /* Owned by malloc.c. */
+    struct magazine_set *magazines;     /* Cached free blocks. */
+
+#ifdef VM
+    /* Owned by vm/frame.c. */
+    size_t frame_cnt;                   /* Resident frames charged. */
+    size_t ws_size;                     /* Working set, in pages. */
+    size_t ws_sample;                   /* Pages seen in this window. */
+    unsigned fault_cnt;                 /* Page faults resolved. */
+    unsigned evict_cnt;                 /* Pages evicted to swap. */
+#endif
+
     /* Owned by thread.c. */
-    unsigned magic;                     /* Detects stack overflow. */
+    unsigned magic;                     /* Detects corruption. */
   };
 
 /* If false (default), use round-robin scheduler.
@@ -123,6 +139,8 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_tick_idle (int64_t cnt);
+bool thread_cpu_idle (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -137,14 +155,16 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+bool thread_is_idle (const struct thread *);
+bool thread_is_running (const struct thread *);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
 
-bool thread_priority_greater(const struct list_elem *a,
-                      const struct list_elem *b,
-                      void *aux UNUSED);
+bool thread_waiter_greater (const struct heap_elem *a,
+                            const struct heap_elem *b,
+                            void *aux UNUSED);
 int thread_get_priority (void);
 void thread_set_priority (int);
 
@@ -158,6 +178,7 @@ int thread_get_load_avg (void);
 void calculate_recent_cpu (struct thread *t, void *aux UNUSED);
 void calculate_priority_mlfqs (struct thread *t, void *aux UNUSED);
 void calculate_load_avg (void);
+void decay_recent_cpu (void);
 bool need_yield (void);
 
 #endif /* threads/thread.h */
@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -54,6 +58,10 @@ exception_init (void)
   intr_register_int (19, 0, INTR_ON, kill,
                      "#XF SIMD Floating-Point Exception");
 
+  /* A double fault gets a task of its own, so that it can be
+     handled even when the kernel stack is unusable. */
+  intr_register_task (8, SEL_DFTSS, "#DF Double Fault Exception");
+
   /* Most exceptions can be handled with interrupts turned on.
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
@@ -148,6 +156,20 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  if (is_user_vaddr (fault_addr) && thread_current ()->pagedir != NULL)
+    {
+      uint32_t *pd = thread_current ()->pagedir;
+
+      /* A not-present page may have been evicted to swap.  A
+         write to a present, read-only page may be the first write
+         to a copy-on-write page. */
+      if (not_present ? frame_swap_in (pd, fault_addr)
+          : write && frame_break_cow (pd, fault_addr))
+        return;
+    }
+#endif
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
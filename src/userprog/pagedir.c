@@ -3,11 +3,58 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/slab.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
+
+/* Number of PDEs that map user virtual addresses. */
+#define USER_PDE_CNT (LOADER_PHYS_BASE >> PDSHIFT)
+
+/* Bookkeeping for a user page directory.
+
+   This lets pagedir_destroy() visit only the page tables that
+   were actually created, and stop as soon as every present page
+   has been freed, so that tearing down a process takes time
+   proportional to the memory it used rather than to the size of
+   its address space. */
+struct pagedir_info
+  {
+    size_t page_cnt;                    /* Present user pages. */
+    size_t swap_cnt;                    /* User pages in swap. */
+    uint32_t pt_map[USER_PDE_CNT / 32]; /* 1 bit per user page table. */
+  };
+
+/* The info for a user page directory is found through its last
+   PDE.  That PDE would map the top 4 MB of kernel virtual
+   memory, which is never used because physical memory is capped
+   at 64 MB (see start.S).  The pointer is word-aligned, so its
+   PTE_P bit is clear and the CPU ignores the entry. */
+#define INFO_PDE (PGSIZE / sizeof (uint32_t) - 1)
+
+/* Cache of `struct pagedir_info's. */
+static struct slab_cache info_cache;
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vaddr);
+
+/* Returns the bookkeeping for user page directory PD. */
+static struct pagedir_info *
+get_info (uint32_t *pd) 
+{
+  ASSERT (pd != init_page_dir);
+  return (struct pagedir_info *) pd[INFO_PDE];
+}
+
+/* Initializes the page directory module. */
+void
+pagedir_init (void) 
+{
+  slab_cache_init (&info_cache, "pagedir_info",
+                   sizeof (struct pagedir_info), NULL);
+}
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -16,9 +63,24 @@ static void invalidate_pagedir (uint32_t *);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
-  if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+  struct pagedir_info *info;
+  uint32_t *pd;
+
+  pd = palloc_get_page (PAL_TAG (MEM_PAGETABLE));
+  if (pd == NULL)
+    return NULL;
+  info = slab_alloc (&info_cache);
+  if (info == NULL)
+    {
+      palloc_free_page (pd);
+      return NULL;
+    }
+  memset (info, 0, sizeof *info);
+
+  memcpy (pd, init_page_dir, PGSIZE);
+  ASSERT (pd[INFO_PDE] == 0);
+  ASSERT (((uintptr_t) info & PTE_P) == 0);
+  pd[INFO_PDE] = (uintptr_t) info;
   return pd;
 }
 
@@ -27,26 +89,50 @@ pagedir_create (void)
 void
 pagedir_destroy (uint32_t *pd) 
 {
-  uint32_t *pde;
+  struct pagedir_info *info;
+  size_t i;
 
   if (pd == NULL)
     return;
 
   ASSERT (pd != init_page_dir);
-  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+  info = get_info (pd);
+  for (i = 0; i < USER_PDE_CNT / 32; i++)
+    while (info->pt_map[i] != 0) 
       {
-        uint32_t *pt = pde_get_pt (*pde);
+        size_t pde_idx = i * 32 + __builtin_ctz (info->pt_map[i]);
+        uint32_t *pt = pde_get_pt (pd[pde_idx]);
         uint32_t *pte;
-        
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
+
+        for (pte = pt; info->page_cnt + info->swap_cnt > 0
+                         && pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & (PTE_P | PTE_SWAP)) 
+            {
+#ifdef VM
+              /* Clears the PTE and adjusts the counts. */
+              frame_unmap (pd, (void *) ((pde_idx << PDSHIFT)
+                                         | ((pte - pt) << PTSHIFT)));
+#else
+              palloc_free_page (pte_get_page (*pte));
+              info->page_cnt--;
+#endif
+            }
         palloc_free_page (pt);
+        info->pt_map[i] &= info->pt_map[i] - 1;
       }
+  ASSERT (info->page_cnt == 0 && info->swap_cnt == 0);
+  slab_free (&info_cache, info);
   palloc_free_page (pd);
 }
 
+/* Returns the number of user pages that are present in PD.
+   Pages that have been swapped out are not counted. */
+size_t
+pagedir_resident_cnt (uint32_t *pd) 
+{
+  return get_info (pd)->page_cnt;
+}
+
 /* Returns the address of the page table entry for virtual
    address VADDR in page directory PD.
    If PD does not have a page table for VADDR, behavior depends
@@ -70,11 +156,14 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
     {
       if (create)
         {
-          pt = palloc_get_page (PAL_ZERO);
+          size_t pde_idx = pde - pd;
+
+          pt = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_PAGETABLE));
           if (pt == NULL) 
             return NULL; 
       
           *pde = pde_create (pt);
+          get_info (pd)->pt_map[pde_idx / 32] |= 1u << (pde_idx % 32);
         }
       else
         return NULL;
@@ -112,6 +201,7 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     {
       ASSERT ((*pte & PTE_P) == 0);
       *pte = pte_create_user (kpage, writable);
+      get_info (pd)->page_cnt++;
       return true;
     }
   else
@@ -152,10 +242,75 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      get_info (pd)->page_cnt--;
+      invalidate_page (pd, upage);
     }
 }
 
+/* Marks present user virtual page UPAGE in PD as swapped out to
+   swap slot SLOT.  The page becomes not present, but its
+   writable and copy-on-write bits are kept so that
+   pagedir_restore_page() can bring it back as it was. */
+void
+pagedir_set_swapped (uint32_t *pd, void *upage, size_t slot) 
+{
+  struct pagedir_info *info = get_info (pd);
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (slot <= PTE_ADDR >> PTSHIFT);
+
+  pte = lookup_page (pd, upage, false);
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  *pte = (slot << PTSHIFT) | (*pte & (PTE_U | PTE_W | PTE_COW)) | PTE_SWAP;
+  info->page_cnt--;
+  info->swap_cnt++;
+  invalidate_page (pd, upage);
+}
+
+/* If user virtual page UPAGE in PD is swapped out, stores its
+   swap slot in *SLOT and returns true.  Otherwise, returns
+   false. */
+bool
+pagedir_get_swapped (uint32_t *pd, const void *upage, size_t *slot) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  if (pte == NULL || (*pte & PTE_SWAP) == 0)
+    return false;
+  *slot = *pte >> PTSHIFT;
+  return true;
+}
+
+/* Maps swapped-out user virtual page UPAGE in PD to KPAGE, with
+   the same permissions it had when it was swapped out. */
+void
+pagedir_restore_page (uint32_t *pd, void *upage, void *kpage) 
+{
+  struct pagedir_info *info = get_info (pd);
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (kpage) == 0);
+
+  pte = lookup_page (pd, upage, false);
+  ASSERT (pte != NULL && (*pte & PTE_SWAP) != 0);
+  *pte = vtop (kpage) | (*pte & (PTE_U | PTE_W | PTE_COW)) | PTE_P;
+  info->swap_cnt--;
+  info->page_cnt++;
+}
+
+/* Forgets that user virtual page UPAGE in PD is swapped out,
+   leaving it unmapped.  Releasing the swap slot is up to the
+   caller. */
+void
+pagedir_clear_swapped (uint32_t *pd, void *upage) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+
+  ASSERT (pte != NULL && (*pte & PTE_SWAP) != 0);
+  *pte = 0;
+  get_info (pd)->swap_cnt--;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -180,7 +335,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,11 +364,38 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Returns true if the PTE for virtual page VPAGE in PD is marked
+   copy-on-write, that is, if the page is mapped read-only only
+   because its frame may be shared and must be copied before the
+   first write.  Returns false if PD contains no PTE for VPAGE. */
+bool
+pagedir_is_cow (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & PTE_COW) != 0;
+}
+
+/* Sets the copy-on-write bit to COW in the PTE for virtual page
+   VPAGE in PD.  The bit is ignored by the CPU, so the TLB need
+   not be invalidated. */
+void
+pagedir_set_cow (uint32_t *pd, const void *vpage, bool cow) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (cow)
+        *pte |= PTE_COW;
+      else 
+        *pte &= ~(uint32_t) PTE_COW;
+    }
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -222,11 +404,19 @@ pagedir_activate (uint32_t *pd)
   if (pd == NULL)
     pd = init_page_dir;
 
+  /* Switching between two threads with the same page directory,
+     such as two kernel threads, needs no TLB flush at all.  Every
+     change to the active page directory's entries has already
+     been invalidated by invalidate_page(). */
+  if (active_pd () == pd)
+    return;
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
-     new page tables immediately.  See [IA32-v2a] "MOV--Move
-     to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
-     Address of the Page Directory". */
+     new page tables immediately and flushes the TLB's non-global
+     entries.  See [IA32-v2a] "MOV--Move to/from Control
+     Registers" and [IA32-v3a] 3.7.5 "Base Address of the Page
+     Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
@@ -243,21 +433,21 @@ active_pd (void)
   return ptov (pd);
 }
 
-/* Seom page table changes can cause the CPU's translation
+/* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry for the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VADDR if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Only that one entry is flushed, so the rest of the
+   TLB, including the kernel's global entries, stays warm.  See
+   [IA32-v2a] "INVLPG" and [IA32-v3a] 3.12 "Translation Lookaside
+   Buffers (TLBs)". */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vaddr) 
 {
   if (active_pd () == pd) 
-    {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+    asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
 }
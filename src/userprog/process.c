@@ -17,6 +17,9 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
@@ -103,6 +106,10 @@ process_exit (void)
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+#ifdef VM
+      frame_print_process_stats (cur);
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -375,7 +382,11 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
         - ZERO_BYTES bytes at UPAGE + READ_BYTES must be zeroed.
 
    The pages initialized by this function must be writable by the
-   user process if WRITABLE is true, read-only otherwise.
+   user process if WRITABLE is true, read-only otherwise.  With
+   VM, pages that contain file data are shared with other
+   processes running the same executable, pages that are
+   entirely zero map a single shared zero frame, and writable
+   pages of either kind are copied on the first write.
 
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
@@ -387,7 +398,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -396,29 +406,54 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-      /* Get a page of memory. */
-      uint8_t *kpage = palloc_get_page (PAL_USER);
-      if (kpage == NULL)
-        return false;
+#ifdef VM
+      uint32_t *pd = thread_current ()->pagedir;
 
-      /* Load this page. */
-      if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
+      if (page_read_bytes > 0)
         {
-          palloc_free_page (kpage);
-          return false; 
+          /* Map a frame shared with every other process running
+             this executable.  Pages of writable segments are
+             copied on the first write. */
+          if (!frame_map_shared (pd, upage, file, ofs, page_read_bytes,
+                                 writable))
+            return false;
         }
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
-
-      /* Add the page to the process's address space. */
-      if (!install_page (upage, kpage, writable)) 
+      else if (page_zero_bytes == PGSIZE)
         {
-          palloc_free_page (kpage);
-          return false; 
+          /* Map the shared zero frame until the page is first
+             written. */
+          if (!frame_map_zero (pd, upage, writable))
+            return false;
+        }
+      else
+#endif
+        {
+          /* Get a page of memory. */
+          uint8_t *kpage = palloc_get_page (PAL_USER);
+          if (kpage == NULL)
+            return false;
+
+          /* Load this page. */
+          if (file_read_at (file, kpage, page_read_bytes, ofs)
+              != (int) page_read_bytes)
+            {
+              palloc_free_page (kpage);
+              return false; 
+            }
+          memset (kpage + page_read_bytes, 0, page_zero_bytes);
+
+          /* Add the page to the process's address space. */
+          if (!install_page (upage, kpage, writable)) 
+            {
+              palloc_free_page (kpage);
+              return false; 
+            }
         }
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
       upage += PGSIZE;
     }
   return true;
@@ -429,18 +464,22 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
-  uint8_t *kpage;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   bool success = false;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+#ifdef VM
+  success = frame_map_private (thread_current ()->pagedir, upage, true);
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
+      success = install_page (upage, kpage, true);
+      if (!success)
         palloc_free_page (kpage);
     }
+#endif
+  if (success)
+    *esp = PHYS_BASE;
   return success;
 }
 
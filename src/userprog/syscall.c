@@ -1,10 +1,15 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 
 static void syscall_handler (struct intr_frame *);
+static bool read_user_word (const void *uaddr, uint32_t *word);
 
 void
 syscall_init (void) 
@@ -13,8 +18,37 @@ syscall_init (void)
 }
 
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+syscall_handler (struct intr_frame *f) 
 {
+  uint32_t number;
+
+  if (read_user_word (f->esp, &number) && number == SYS_CLOCK)
+    {
+      /* Return the clock in EDX:EAX. */
+      int64_t ns = timer_ns ();
+      f->eax = ns;
+      f->edx = ns >> 32;
+      return;
+    }
+
   printf ("system call!\n");
   thread_exit ();
 }
+
+/* Copies the 32-bit word at user address UADDR into *WORD.
+   Returns true if successful, false if any of its bytes is not
+   mapped in the running process. */
+static bool
+read_user_word (const void *uaddr, uint32_t *word)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const uint8_t *first = uaddr;
+  const uint8_t *last = first + sizeof *word - 1;
+
+  if (pd == NULL || !is_user_vaddr (first) || !is_user_vaddr (last)
+      || pagedir_get_page (pd, first) == NULL
+      || pagedir_get_page (pd, last) == NULL)
+    return false;
+  memcpy (word, uaddr, sizeof *word);
+  return true;
+}
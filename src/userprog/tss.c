@@ -1,7 +1,9 @@
 #include "userprog/tss.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
+#include "threads/init.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -47,7 +49,16 @@
    See [IA32-v3a] 6.2.1 "Task-State Segment (TSS)" for a
    description of the TSS.  See [IA32-v3a] 5.12.1 "Exception- or
    Interrupt-Handler Procedures" for a description of when and
-   how stack switching occurs during an interrupt. */
+   how stack switching occurs during an interrupt.
+
+   We also use one real task.  A thread that overflows its kernel
+   stack faults on the unmapped guard page below it, and the CPU
+   then cannot push the page fault's frame onto that stack
+   either, which turns the fault into a double fault.  The only
+   way to handle a double fault in that situation is through a
+   task gate, which makes the CPU switch to a second TSS that
+   brings its own stack.  The handler just reports the overflow
+   and panics. */
 struct tss
   {
     uint16_t back_link, :16;
@@ -75,6 +86,12 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+/* TSS for double faults, at the bottom of a page whose rest is
+   the double fault handler's stack. */
+static struct tss *df_tss;
+
+static void double_fault (void) NO_RETURN;
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void) 
@@ -86,6 +103,17 @@ tss_init (void)
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
   tss_update ();
+
+  /* The double fault task starts afresh in double_fault() every
+     time, with interrupts off, in the kernel's address space. */
+  df_tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  df_tss->cr3 = vtop (init_page_dir);
+  df_tss->eip = double_fault;
+  df_tss->eflags = 0x00000002;
+  df_tss->esp = (uint32_t) df_tss + PGSIZE;
+  df_tss->cs = SEL_KCSEG;
+  df_tss->ss = df_tss->ds = df_tss->es = SEL_KDSEG;
+  df_tss->bitmap = 0xdfff;
 }
 
 /* Returns the kernel TSS. */
@@ -96,11 +124,31 @@ tss_get (void)
   return tss;
 }
 
+/* Returns the TSS for double faults. */
+struct tss *
+tss_get_double_fault (void) 
+{
+  ASSERT (df_tss != NULL);
+  return df_tss;
+}
+
 /* Sets the ring 0 stack pointer in the TSS to point to the end
-   of the thread stack. */
+   of the thread stack, which is just below its `struct thread'.
+   (This is wrong for the initial thread, but it never runs user
+   code.) */
 void
 tss_update (void) 
 {
   ASSERT (tss != NULL);
-  tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  tss->esp0 = thread_current ();
+}
+
+/* Entry point of the double fault task.  The CPU saved the
+   state of the thread that faulted in the kernel TSS. */
+static void
+double_fault (void) 
+{
+  PANIC ("double fault in thread \"%s\" at eip %p, esp %#"PRIx32
+         "; kernel stack overflow?",
+         thread_name (), (void *) tss->eip, tss->esp);
 }
@@ -0,0 +1,1017 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/slab.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/swap.h"
+
+/* User frame table.
+
+   Every frame from the user pool that is mapped into a process
+   is described by a struct frame, which lists the page table
+   entries that map it, so that the frame can be unmapped from
+   all of them at once when it is evicted to swap.
+
+   Sharing.  Every process running the same program would
+   otherwise read its own private copy of each page of the
+   executable.  Instead, a page loaded from an executable is
+   identified by the inode it came from, its offset within the
+   inode, and the number of bytes read from the file (the rest of
+   the page is zero), and the first process to load that page
+   registers its frame here.  Later processes that load an
+   identical page simply map the same frame.
+
+   Shared frames are always mapped read-only.  Pages of writable
+   segments are additionally marked copy-on-write in the page
+   table, so that the first write fault gives the writer its own
+   private copy (see frame_break_cow()).  While any of its pages
+   are shared, writes to the executable are denied, so that the
+   contents of a shared frame always match the file.
+
+   Pages that start out entirely zero, such as most of a
+   program's BSS, all map a single read-only zero frame.  It is
+   never freed or evicted, and a write to it is satisfied by
+   mapping a freshly zeroed private frame in its place.
+
+   Replacement.  When the user pool runs dry, a clock hand sweeps
+   the frames, clearing accessed bits as it goes, to choose one
+   to evict.  Each frame that is not shared is charged to the
+   thread that mapped it, and every WS_WINDOW timer ticks the
+   pages each thread touched during the last window are counted
+   as its working set.  A thread's soft quota is the larger of
+   its working set and an equal share of all the frames.  The
+   clock first looks only for unreferenced frames of threads over
+   their quota, so that one process that sweeps through a lot of
+   memory can't push everyone else's working sets out; then for
+   any frame not used within the last window; and finally takes
+   whatever it finds.  A shared frame is charged to nobody and is
+   only taken by the later sweeps.
+
+   An evicted page is written to swap and every page table entry
+   that mapped it is marked with its swap slot.  A page that was
+   shared comes back as a private copy for each process that
+   touches it again.  A frame remembers the slot holding a clean
+   copy of its contents, if any, so that evicting it again
+   before it is modified needs no write at all.
+
+   Background pager.  A low-priority kernel thread keeps a small
+   pool of pre-zeroed free frames, so that stack pages and first
+   writes to zero pages usually don't have to clear a page while
+   the faulting process waits.  While memory is tight, it also
+   writes dirty frames just ahead of the clock hand that have not
+   been used for a window out to swap, so that when the hand
+   reaches them they can be evicted without waiting for a write.
+
+   Synchronization.  frame_lock protects this module's data and
+   also the user entries of every page directory, which are
+   changed only by this module once a process has started
+   loading.  It is held across file and swap I/O, which keeps
+   frames from being evicted while they are being filled. */
+
+/* Ticks in one working-set sampling window. */
+#define WS_WINDOW (TIMER_FREQ / 4)
+
+/* Number of pre-zeroed frames the pager keeps ready. */
+#define ZERO_POOL_SIZE 16
+
+/* Maximum number of frames the pager cleans per window. */
+#define PRECLEAN_BATCH 8
+
+/* A page table entry that maps a frame. */
+struct mapping
+  {
+    struct list_elem elem;              /* Element in frame's list. */
+    uint32_t *pd;                       /* Page directory. */
+    void *upage;                        /* User virtual page. */
+  };
+
+/* A user frame. */
+struct frame
+  {
+    void *kpage;                        /* Kernel virtual address. */
+    struct list mappings;               /* List of struct mapping. */
+    struct thread *owner;               /* Charged thread, if any. */
+    int64_t last_use;                   /* Tick when last seen accessed. */
+    bool pinned;                        /* True to prevent eviction. */
+    swap_slot_t slot;                   /* Clean copy, or SWAP_ERROR. */
+    struct list_elem clock_elem;        /* Element in clock_list. */
+    struct hash_elem page_elem;         /* Element in frames_by_page. */
+
+    /* Shared frames only. */
+    struct inode *inode;                /* Executable the page is from. */
+    off_t ofs;                          /* Offset of page in INODE. */
+    size_t read_bytes;                  /* Bytes read from INODE. */
+    struct hash_elem key_elem;          /* Element in frames_by_key. */
+  };
+
+/* All frames, indexed by kernel virtual address, and shared
+   frames, indexed by (inode, offset, read_bytes). */
+static struct hash frames_by_page;
+static struct hash frames_by_key;
+
+/* All frames in clock order, and the next one the clock hand
+   will examine. */
+static struct list clock_list;
+static struct list_elem *clock_hand;
+
+/* Number of frames, and number of threads charged for at least
+   one frame. */
+static size_t frame_cnt;
+static size_t owner_cnt;
+
+/* Start of the current working-set sampling window. */
+static int64_t window_start;
+
+/* Protects all of the above and user page tables. */
+static struct lock frame_lock;
+
+/* Caches of frames and mappings. */
+static struct slab_cache frame_cache;
+static struct slab_cache mapping_cache;
+
+/* The shared zero frame. */
+static void *zero_kpage;
+
+/* Free user pages that the pager has already zeroed. */
+static void *zero_pool[ZERO_POOL_SIZE];
+static size_t zero_pool_cnt;
+
+/* Set when the user pool runs dry, cleared by the pager. */
+static bool memory_tight;
+
+/* Statistics. */
+static long long fault_cnt;     /* Faults resolved. */
+static long long evict_cnt;     /* Pages evicted. */
+static long long clean_cnt;     /* Pages written ahead by the pager. */
+static long long prezero_cnt;   /* Frames taken from zero_pool. */
+
+/* -vmstats: Print each process's paging counts when it exits? */
+bool frame_print_exits;
+
+static hash_hash_func page_hash, key_hash;
+static hash_less_func page_less, key_less;
+static bool is_mapped (uint32_t *pd, const void *upage);
+static struct frame *new_frame (struct thread *owner, bool zero);
+static void discard_frame (struct frame *);
+static void forget_frame (struct frame *);
+static void charge (struct frame *, struct thread *);
+static bool add_mapping (struct frame *, uint32_t *pd, void *upage,
+                         bool writable, bool cow);
+static struct mapping *find_mapping (struct frame *,
+                                     uint32_t *pd, const void *upage);
+static struct frame *lookup_page (void *kpage);
+static void unshare (struct frame *);
+static void *evict (void);
+static thread_func pager;
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  hash_init (&frames_by_page, page_hash, page_less, NULL);
+  hash_init (&frames_by_key, key_hash, key_less, NULL);
+  slab_cache_init (&frame_cache, "frame", sizeof (struct frame), NULL);
+  slab_cache_init (&mapping_cache, "mapping", sizeof (struct mapping), NULL);
+  list_init (&clock_list);
+  clock_hand = list_end (&clock_list);
+  lock_init (&frame_lock);
+  zero_kpage = palloc_get_page (PAL_USER | PAL_ZERO | PAL_ASSERT);
+}
+
+/* Starts the background pager thread.  Must be called after the
+   thread system and swap have been initialized. */
+void
+frame_start (void)
+{
+  thread_create ("pager", PRI_MIN, pager, NULL);
+}
+
+/* Maps a new, zeroed frame private to the current thread at user
+   virtual page UPAGE in PD.  Returns true if successful, false if
+   UPAGE is already mapped or memory is exhausted. */
+bool
+frame_map_private (uint32_t *pd, void *upage, bool writable)
+{
+  struct frame *f;
+  bool success = false;
+
+  lock_acquire (&frame_lock);
+  if (!is_mapped (pd, upage))
+    {
+      f = new_frame (thread_current (), true);
+      if (f != NULL)
+        {
+          success = add_mapping (f, pd, upage, writable, false);
+          if (!success)
+            discard_frame (f);
+        }
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Maps a frame that holds READ_BYTES bytes of FILE starting at
+   offset OFS, followed by zeros up to the end of the page, at
+   user virtual page UPAGE in PD.  If another process already has
+   an identical page mapped, maps its frame, otherwise reads a new
+   one from FILE.  The page is mapped read-only; if WRITABLE is
+   true, it is also marked copy-on-write.
+   Returns true if successful, false if UPAGE is already mapped,
+   memory is exhausted, or the file cannot be read. */
+bool
+frame_map_shared (uint32_t *pd, void *upage, struct file *file,
+                  off_t ofs, size_t read_bytes, bool writable)
+{
+  struct frame key, *f;
+  struct hash_elem *e;
+  bool success = false;
+
+  ASSERT (ofs % PGSIZE == 0);
+  ASSERT (read_bytes > 0 && read_bytes <= PGSIZE);
+
+  key.inode = file_get_inode (file);
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+
+  /* The read below is done with frame_lock held, so that two
+     processes starting the same program at the same time don't
+     both load the page. */
+  lock_acquire (&frame_lock);
+  if (is_mapped (pd, upage))
+    goto done;
+  e = hash_find (&frames_by_key, &key.key_elem);
+  if (e != NULL)
+    f = hash_entry (e, struct frame, key_elem);
+  else
+    {
+      f = new_frame (NULL, false);
+      if (f == NULL)
+        goto done;
+      if (file_read_at (file, f->kpage, read_bytes, ofs) != (off_t) read_bytes)
+        {
+          discard_frame (f);
+          goto done;
+        }
+      memset ((uint8_t *) f->kpage + read_bytes, 0, PGSIZE - read_bytes);
+
+      f->inode = inode_reopen (key.inode);
+      f->ofs = ofs;
+      f->read_bytes = read_bytes;
+      inode_deny_write (f->inode);
+      hash_insert (&frames_by_key, &f->key_elem);
+    }
+  success = add_mapping (f, pd, upage, false, writable);
+  if (!success && list_empty (&f->mappings))
+    discard_frame (f);
+
+ done:
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Maps the shared zero frame at user virtual page UPAGE in PD.
+   The page is mapped read-only; if WRITABLE is true, it is also
+   marked copy-on-write.  Returns true if successful, false if
+   UPAGE is already mapped or memory is exhausted. */
+bool
+frame_map_zero (uint32_t *pd, void *upage, bool writable)
+{
+  bool success = false;
+
+  lock_acquire (&frame_lock);
+  if (!is_mapped (pd, upage) && pagedir_set_page (pd, upage, zero_kpage, false))
+    {
+      if (writable)
+        pagedir_set_cow (pd, upage, true);
+      success = true;
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Unmaps user virtual page UPAGE from PD, freeing the frame or
+   swap slot that backs it if no other page maps it.  UPAGE need
+   not be mapped. */
+void
+frame_unmap (uint32_t *pd, void *upage)
+{
+  swap_slot_t slot;
+  void *kpage;
+
+  lock_acquire (&frame_lock);
+  if (pagedir_get_swapped (pd, upage, &slot))
+    {
+      pagedir_clear_swapped (pd, upage);
+      swap_release (slot);
+    }
+  else if ((kpage = pagedir_get_page (pd, upage)) != NULL)
+    {
+      pagedir_clear_page (pd, upage);
+      if (kpage != zero_kpage)
+        {
+          struct frame *f = lookup_page (kpage);
+          struct mapping *m = find_mapping (f, pd, upage);
+
+          list_remove (&m->elem);
+          slab_free (&mapping_cache, m);
+          if (list_empty (&f->mappings))
+            discard_frame (f);
+        }
+    }
+  lock_release (&frame_lock);
+}
+
+/* Handles a write fault on user virtual page UPAGE in PD.  If
+   the page is marked copy-on-write, gives PD a private, writable
+   copy of it and returns true.  Returns false if the page is not
+   copy-on-write, meaning that the write really was illegal, or
+   if no memory is available for the copy.  Also returns true if
+   the page was evicted before we got here, so that the faulting
+   access is retried and brings it back in. */
+bool
+frame_break_cow (uint32_t *pd, const void *upage_)
+{
+  void *upage = pg_round_down (upage_);
+  void *old_kpage;
+  struct frame *f, *new;
+  struct mapping *m;
+  swap_slot_t slot;
+  bool success = false;
+
+  lock_acquire (&frame_lock);
+  old_kpage = pagedir_get_page (pd, upage);
+  if (old_kpage == NULL)
+    {
+      success = pagedir_get_swapped (pd, upage, &slot);
+      goto done;
+    }
+  if (!pagedir_is_cow (pd, upage))
+    goto done;
+
+  f = old_kpage != zero_kpage ? lookup_page (old_kpage) : NULL;
+  if (f != NULL && list_size (&f->mappings) == 1)
+    {
+      /* We hold the only mapping, so take the frame over
+         instead of copying it. */
+      if (f->inode != NULL)
+        unshare (f);
+      charge (f, thread_current ());
+    }
+  else
+    {
+      /* Someone else still maps the frame, or it's the zero
+         frame, so copy it.  The old frame must not be evicted
+         while we make room for the copy. */
+      m = (f != NULL
+           ? find_mapping (f, pd, upage)
+           : slab_alloc (&mapping_cache));
+      if (m == NULL)
+        goto done;
+      if (f != NULL)
+        f->pinned = true;
+      new = new_frame (thread_current (), f == NULL);
+      if (f != NULL)
+        f->pinned = false;
+      if (new == NULL)
+        {
+          if (f == NULL)
+            slab_free (&mapping_cache, m);
+          goto done;
+        }
+      if (f != NULL)
+        memcpy (new->kpage, old_kpage, PGSIZE);
+
+      if (f != NULL)
+        list_remove (&m->elem);
+      m->pd = pd;
+      m->upage = upage;
+      list_push_back (&new->mappings, &m->elem);
+      old_kpage = new->kpage;
+    }
+  pagedir_clear_page (pd, upage);
+  if (!pagedir_set_page (pd, upage, old_kpage, true))
+    NOT_REACHED ();
+  thread_current ()->fault_cnt++;
+  fault_cnt++;
+  success = true;
+
+ done:
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Handles a not-present fault on user virtual page UPAGE in PD.
+   If the page was evicted to swap, reads it back into a new
+   frame and returns true.  Returns false if the page was never
+   mapped, meaning that the access really was illegal, or if no
+   memory is available. */
+bool
+frame_swap_in (uint32_t *pd, const void *upage_)
+{
+  void *upage = pg_round_down (upage_);
+  struct frame *f;
+  struct mapping *m;
+  swap_slot_t slot;
+  bool success = false;
+
+  lock_acquire (&frame_lock);
+  if (pagedir_get_swapped (pd, upage, &slot))
+    {
+      m = slab_alloc (&mapping_cache);
+      f = m != NULL ? new_frame (thread_current (), false) : NULL;
+      if (f != NULL)
+        {
+          /* The page table's reference to the slot becomes the
+             frame's, so the slot stays behind as a clean copy. */
+          swap_read (slot, f->kpage);
+          f->slot = slot;
+          pagedir_restore_page (pd, upage, f->kpage);
+          m->pd = pd;
+          m->upage = upage;
+          list_push_back (&f->mappings, &m->elem);
+          thread_current ()->fault_cnt++;
+          fault_cnt++;
+          success = true;
+        }
+      else
+        slab_free (&mapping_cache, m);
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Prints the page faults that process T has resolved and the
+   pages that have been evicted from it, if -vmstats was given.
+   Called when T exits. */
+void
+frame_print_process_stats (const struct thread *t)
+{
+  if (frame_print_exits)
+    printf ("%s: %u faults, %u evictions\n",
+            t->name, t->fault_cnt, t->evict_cnt);
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu in use, %lld faults resolved, %lld evicted, "
+          "%lld precleaned, %lld prezeroed\n",
+          frame_cnt, fault_cnt, evict_cnt, clean_cnt, prezero_cnt);
+}
+
+/* Returns true if user virtual page UPAGE in PD is mapped to a
+   frame or swapped out.  frame_lock must be held. */
+static bool
+is_mapped (uint32_t *pd, const void *upage)
+{
+  swap_slot_t slot;
+
+  return (pagedir_get_page (pd, upage) != NULL
+          || pagedir_get_swapped (pd, upage, &slot));
+}
+
+/* Returns a free user page, zeroed if ZERO is true, taking it
+   from the pager's pool of zeroed pages, from the user pool, or
+   by evicting a frame, in that order of preference if ZERO is
+   true and otherwise in the reverse order of the first two.
+   Returns a null pointer if no page could be found.  frame_lock
+   must be held. */
+static void *
+get_page (bool zero)
+{
+  void *kpage = NULL;
+
+  if (zero && zero_pool_cnt > 0)
+    {
+      prezero_cnt++;
+      return zero_pool[--zero_pool_cnt];
+    }
+
+  kpage = palloc_get_page (PAL_USER);
+  if (kpage == NULL)
+    {
+      memory_tight = true;
+      if (zero_pool_cnt > 0)
+        kpage = zero_pool[--zero_pool_cnt];
+      else
+        kpage = evict ();
+    }
+  if (kpage != NULL && zero)
+    memset (kpage, 0, PGSIZE);
+  return kpage;
+}
+
+/* Allocates a frame with no mappings, charged to OWNER (which
+   may be null).  The frame's contents are zero if ZERO is true,
+   otherwise garbage.  Returns the new frame, or a null pointer
+   if no page could be found.  frame_lock must be held. */
+static struct frame *
+new_frame (struct thread *owner, bool zero)
+{
+  struct frame *f;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  f = slab_alloc (&frame_cache);
+  if (f == NULL)
+    return NULL;
+  f->kpage = get_page (zero);
+  if (f->kpage == NULL)
+    {
+      slab_free (&frame_cache, f);
+      return NULL;
+    }
+
+  list_init (&f->mappings);
+  f->owner = NULL;
+  charge (f, owner);
+  f->last_use = timer_ticks ();
+  f->pinned = false;
+  f->slot = SWAP_ERROR;
+  f->inode = NULL;
+  hash_insert (&frames_by_page, &f->page_elem);
+
+  /* Insert behind the clock hand, so that the new frame is the
+     last one the hand examines. */
+  list_insert (clock_hand, &f->clock_elem);
+  frame_cnt++;
+  return f;
+}
+
+/* Frees frame F and its page.  F must have no mappings.
+   frame_lock must be held. */
+static void
+discard_frame (struct frame *f)
+{
+  void *kpage = f->kpage;
+
+  forget_frame (f);
+  palloc_free_page (kpage);
+}
+
+/* Removes F from the frame table and frees it, but not its page.
+   F must have no mappings.  frame_lock must be held. */
+static void
+forget_frame (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (list_empty (&f->mappings));
+
+  if (f->inode != NULL)
+    unshare (f);
+  if (f->slot != SWAP_ERROR)
+    swap_release (f->slot);
+  charge (f, NULL);
+  hash_delete (&frames_by_page, &f->page_elem);
+  if (clock_hand == &f->clock_elem)
+    clock_hand = list_next (clock_hand);
+  list_remove (&f->clock_elem);
+  frame_cnt--;
+  slab_free (&frame_cache, f);
+}
+
+/* Charges frame F to thread T instead of its current owner.  T
+   may be null to charge F to nobody. */
+static void
+charge (struct frame *f, struct thread *t)
+{
+  if (f->owner != NULL && --f->owner->frame_cnt == 0)
+    owner_cnt--;
+  f->owner = t;
+  if (t != NULL && t->frame_cnt++ == 0)
+    owner_cnt++;
+}
+
+/* Maps F at user virtual page UPAGE in PD, read/write if
+   WRITABLE is true, read-only otherwise, and copy-on-write if
+   COW is true.  Returns true if successful, false if memory is
+   exhausted. */
+static bool
+add_mapping (struct frame *f, uint32_t *pd, void *upage,
+             bool writable, bool cow)
+{
+  struct mapping *m = slab_alloc (&mapping_cache);
+  if (m == NULL)
+    return false;
+  if (!pagedir_set_page (pd, upage, f->kpage, writable))
+    {
+      slab_free (&mapping_cache, m);
+      return false;
+    }
+  if (cow)
+    pagedir_set_cow (pd, upage, true);
+
+  m->pd = pd;
+  m->upage = upage;
+  list_push_back (&f->mappings, &m->elem);
+  return true;
+}
+
+/* Returns F's mapping at UPAGE in PD, which must exist. */
+static struct mapping *
+find_mapping (struct frame *f, uint32_t *pd, const void *upage)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->mappings); e != list_end (&f->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->pd == pd && m->upage == upage)
+        return m;
+    }
+  NOT_REACHED ();
+}
+
+/* Returns the frame for KPAGE, which must exist.  frame_lock
+   must be held. */
+static struct frame *
+lookup_page (void *kpage)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  key.kpage = kpage;
+  e = hash_find (&frames_by_page, &key.page_elem);
+  ASSERT (e != NULL);
+  return hash_entry (e, struct frame, page_elem);
+}
+
+/* Removes F from the shared frame table, making it an ordinary
+   frame that is charged to nobody.  frame_lock must be held. */
+static void
+unshare (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  hash_delete (&frames_by_key, &f->key_elem);
+  inode_allow_write (f->inode);
+  inode_close (f->inode);
+  f->inode = NULL;
+}
+
+/* Returns true if any page table entry that maps F has its
+   accessed bit set, without clearing it. */
+static bool
+is_accessed (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->mappings); e != list_end (&f->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (pagedir_is_accessed (m->pd, m->upage))
+        return true;
+    }
+  return false;
+}
+
+/* Returns true if F's contents differ from its clean copy in
+   swap, or if it has none. */
+static bool
+is_dirty (struct frame *f)
+{
+  struct list_elem *e;
+
+  if (f->slot == SWAP_ERROR)
+    return true;
+  for (e = list_begin (&f->mappings); e != list_end (&f->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (pagedir_is_dirty (m->pd, m->upage))
+        return true;
+    }
+  return false;
+}
+
+/* Returns true if any page table entry that maps F has been
+   accessed since the last call, clearing the accessed bits and
+   recording NOW as F's last use if so. */
+static bool
+test_accessed (struct frame *f, int64_t now)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->mappings); e != list_end (&f->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (pagedir_is_accessed (m->pd, m->upage))
+        {
+          pagedir_set_accessed (m->pd, m->upage, false);
+          accessed = true;
+        }
+    }
+  if (accessed)
+    f->last_use = now;
+  return accessed;
+}
+
+/* If a full window has passed since the last sample, sets each
+   owner's working set size to the number of its frames used
+   during that window.  Sampling is only needed to choose a
+   victim, so it is done lazily from there rather than from the
+   timer interrupt, which could not take frame_lock anyway. */
+static void
+sample_working_sets (int64_t now)
+{
+  int64_t prev_start = window_start;
+  struct list_elem *e;
+
+  if (now - window_start < WS_WINDOW)
+    return;
+  window_start = now;
+
+  for (e = list_begin (&clock_list); e != list_end (&clock_list);
+       e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, clock_elem);
+      if (f->owner != NULL)
+        f->owner->ws_sample = 0;
+    }
+  for (e = list_begin (&clock_list); e != list_end (&clock_list);
+       e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, clock_elem);
+      test_accessed (f, now);
+      if (f->owner != NULL && f->last_use >= prev_start)
+        f->owner->ws_sample++;
+    }
+  for (e = list_begin (&clock_list); e != list_end (&clock_list);
+       e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, clock_elem);
+      if (f->owner != NULL)
+        f->owner->ws_size = f->owner->ws_sample;
+    }
+}
+
+/* Returns true if thread T, which may be null, holds more frames
+   than its soft quota. */
+static bool
+over_quota (const struct thread *t, size_t fair_share)
+{
+  return (t != NULL
+          && t->frame_cnt > (t->ws_size > fair_share ? t->ws_size : fair_share));
+}
+
+/* Returns the frame under the clock hand and advances the
+   hand. */
+static struct frame *
+clock_next (void)
+{
+  struct frame *f;
+
+  if (clock_hand == list_end (&clock_list))
+    clock_hand = list_begin (&clock_list);
+  f = list_entry (clock_hand, struct frame, clock_elem);
+  clock_hand = list_next (clock_hand);
+  return f;
+}
+
+/* Chooses a frame to evict, as described at the top of the file,
+   or returns a null pointer if every frame is pinned. */
+static struct frame *
+choose_victim (void)
+{
+  int64_t now = timer_ticks ();
+  size_t fair_share;
+  size_t i;
+  int pass;
+
+  sample_working_sets (now);
+  fair_share = owner_cnt > 0 ? frame_cnt / owner_cnt : frame_cnt;
+
+  for (pass = 0; pass < 3; pass++)
+    for (i = 0; i < frame_cnt; i++)
+      {
+        struct frame *f = clock_next ();
+
+        if (f->pinned || list_empty (&f->mappings))
+          continue;
+        if (pass < 2 && test_accessed (f, now))
+          continue;
+        if (pass == 0
+            ? over_quota (f->owner, fair_share)
+            : pass == 1 ? now - f->last_use >= WS_WINDOW : true)
+          return f;
+      }
+  return NULL;
+}
+
+/* Evicts a frame to swap and returns its page, or returns a null
+   pointer if no frame can be evicted or swap is full.
+   frame_lock must be held. */
+static void *
+evict (void)
+{
+  struct frame *f;
+  swap_slot_t slot;
+  void *kpage;
+  bool dirty;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  f = choose_victim ();
+  if (f == NULL)
+    return NULL;
+
+  /* A clean copy may already be in swap.  Otherwise write to a
+     fresh slot, because the old one may still be in use by page
+     tables that mapped the frame before it was last evicted. */
+  dirty = is_dirty (f);
+  slot = dirty ? swap_alloc () : f->slot;
+  if (slot == SWAP_ERROR)
+    return NULL;
+
+  /* Unmap the frame everywhere before writing it out, so that
+     nobody can change it while it is being written. */
+  while (!list_empty (&f->mappings))
+    {
+      struct list_elem *e = list_pop_front (&f->mappings);
+      struct mapping *m = list_entry (e, struct mapping, elem);
+
+      pagedir_set_swapped (m->pd, m->upage, slot);
+      swap_ref (slot);
+      slab_free (&mapping_cache, m);
+    }
+  if (dirty)
+    swap_write (slot, f->kpage);
+
+  if (f->owner != NULL)
+    f->owner->evict_cnt++;
+  evict_cnt++;
+  kpage = f->kpage;
+  forget_frame (f);
+  return kpage;
+}
+
+/* Writes F, which is still mapped, to a fresh swap slot and
+   makes that its clean copy.  Returns false if swap is full.
+   frame_lock must be held. */
+static bool
+clean_frame (struct frame *f)
+{
+  swap_slot_t slot = swap_alloc ();
+  struct list_elem *e;
+
+  if (slot == SWAP_ERROR)
+    return false;
+  swap_ref (slot);
+  if (f->slot != SWAP_ERROR)
+    swap_release (f->slot);
+  f->slot = slot;
+
+  /* Clear the dirty bits before writing, so that a write to the
+     page while we wait for the disk makes it dirty again. */
+  for (e = list_begin (&f->mappings); e != list_end (&f->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      pagedir_set_dirty (m->pd, m->upage, false);
+    }
+  swap_write (slot, f->kpage);
+  clean_cnt++;
+  return true;
+}
+
+/* Tops up zero_pool from the user pool. */
+static void
+refill_zero_pool (void)
+{
+  while (zero_pool_cnt < ZERO_POOL_SIZE)
+    {
+      /* Zero the page without holding frame_lock. */
+      void *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (kpage == NULL)
+        {
+          memory_tight = true;
+          break;
+        }
+
+      lock_acquire (&frame_lock);
+      if (zero_pool_cnt < ZERO_POOL_SIZE)
+        {
+          zero_pool[zero_pool_cnt++] = kpage;
+          kpage = NULL;
+        }
+      lock_release (&frame_lock);
+      if (kpage != NULL)
+        palloc_free_page (kpage);
+    }
+}
+
+/* Cleans up to PRECLEAN_BATCH dirty frames that the clock hand
+   is about to reach and that have not been used for a window. */
+static void
+preclean (void)
+{
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+  size_t cleaned = 0;
+  size_t i;
+
+  lock_acquire (&frame_lock);
+  e = clock_hand;
+  for (i = 0; i < frame_cnt && cleaned < PRECLEAN_BATCH; i++)
+    {
+      struct frame *f;
+
+      if (e == list_end (&clock_list))
+        e = list_begin (&clock_list);
+      f = list_entry (e, struct frame, clock_elem);
+      e = list_next (e);
+
+      if (f->pinned || list_empty (&f->mappings)
+          || now - f->last_use < WS_WINDOW
+          || is_accessed (f) || !is_dirty (f))
+        continue;
+      if (!clean_frame (f))
+        break;
+      cleaned++;
+    }
+  memory_tight = false;
+  lock_release (&frame_lock);
+}
+
+/* Background pager thread. */
+static void
+pager (void *aux UNUSED)
+{
+  if (thread_mlfqs)
+    thread_set_nice (NICE_MAX);
+
+  for (;;)
+    {
+      refill_zero_pool ();
+      if (memory_tight)
+        preclean ();
+      timer_sleep (WS_WINDOW);
+    }
+}
+
+/* Returns a hash value for the frame that E is embedded in by
+   its kernel virtual address. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, page_elem);
+  return hash_int (pg_no (f->kpage));
+}
+
+/* Returns true if frame A precedes frame B by kernel virtual
+   address. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, page_elem);
+  const struct frame *b = hash_entry (b_, struct frame, page_elem);
+  return a->kpage < b->kpage;
+}
+
+/* Returns a hash value for the frame that E is embedded in by
+   its contents' location in the file system. */
+static unsigned
+key_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, key_elem);
+  return (hash_int (inode_get_inumber (f->inode))
+          ^ hash_int (f->ofs)
+          ^ hash_int (f->read_bytes));
+}
+
+/* Returns true if frame A precedes frame B by its contents'
+   location in the file system. */
+static bool
+key_less (const struct hash_elem *a_, const struct hash_elem *b_,
+          void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, key_elem);
+  const struct frame *b = hash_entry (b_, struct frame, key_elem);
+  block_sector_t a_sector = inode_get_inumber (a->inode);
+  block_sector_t b_sector = inode_get_inumber (b->inode);
+
+  if (a_sector != b_sector)
+    return a_sector < b_sector;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
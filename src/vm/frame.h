@@ -0,0 +1,27 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct thread;
+
+/* -vmstats: Print each process's paging counts when it exits? */
+extern bool frame_print_exits;
+
+void frame_init (void);
+void frame_start (void);
+bool frame_map_private (uint32_t *pd, void *upage, bool writable);
+bool frame_map_shared (uint32_t *pd, void *upage, struct file *,
+                       off_t ofs, size_t read_bytes, bool writable);
+bool frame_map_zero (uint32_t *pd, void *upage, bool writable);
+void frame_unmap (uint32_t *pd, void *upage);
+bool frame_break_cow (uint32_t *pd, const void *upage);
+bool frame_swap_in (uint32_t *pd, const void *upage);
+void frame_print_stats (void);
+void frame_print_process_stats (const struct thread *);
+
+#endif /* vm/frame.h */
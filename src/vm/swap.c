@@ -0,0 +1,110 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <limits.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* Swap device.
+
+   The swap device is divided into page-sized slots.  A slot is
+   reference counted, because a page that was shared by several
+   page directories when it was evicted is remembered by each of
+   their page tables.  The slot is freed when the last of them
+   reads it back in or goes away.
+
+   The callers in vm/frame.c serialize all swap operations, so
+   there is no locking here. */
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Slots in use and the number of references to each.  A shared
+   page may be mapped by any number of processes, so a count may
+   be as large as the number of processes. */
+static struct bitmap *used_slots;
+static unsigned *slot_refs;
+
+/* Finds the swap device and sets up its slot table.  If there is
+   no swap device, swap_alloc() will always fail. */
+void
+swap_init (void)
+{
+  size_t slot_cnt;
+
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  slot_cnt = block_size (swap_device) / PAGE_SECTORS;
+  used_slots = bitmap_create (slot_cnt);
+  slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+  if (used_slots == NULL || slot_refs == NULL)
+    PANIC ("swap: out of memory for %zu slots", slot_cnt);
+}
+
+/* Allocates a swap slot with a reference count of 0 and returns
+   it, or returns SWAP_ERROR if the swap device is full or
+   missing.  Take one reference with swap_ref() for each page
+   table entry that will remember the slot. */
+swap_slot_t
+swap_alloc (void)
+{
+  size_t slot;
+
+  if (swap_device == NULL)
+    return SWAP_ERROR;
+  slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+  slot_refs[slot] = 0;
+  return slot;
+}
+
+/* Adds a reference to SLOT. */
+void
+swap_ref (swap_slot_t slot)
+{
+  ASSERT (bitmap_test (used_slots, slot));
+  ASSERT (slot_refs[slot] < UINT_MAX);
+  slot_refs[slot]++;
+}
+
+/* Drops a reference to SLOT, freeing it if it was the last. */
+void
+swap_release (swap_slot_t slot)
+{
+  ASSERT (bitmap_test (used_slots, slot));
+  ASSERT (slot_refs[slot] > 0);
+  if (--slot_refs[slot] == 0)
+    bitmap_reset (used_slots, slot);
+}
+
+/* Writes PAGE to SLOT. */
+void
+swap_write (swap_slot_t slot, const void *page)
+{
+  size_t i;
+
+  ASSERT (bitmap_test (used_slots, slot));
+  for (i = 0; i < PAGE_SECTORS; i++)
+    block_write (swap_device, slot * PAGE_SECTORS + i,
+                 (const uint8_t *) page + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SLOT into PAGE. */
+void
+swap_read (swap_slot_t slot, void *page)
+{
+  size_t i;
+
+  ASSERT (bitmap_test (used_slots, slot));
+  for (i = 0; i < PAGE_SECTORS; i++)
+    block_read (swap_device, slot * PAGE_SECTORS + i,
+                (uint8_t *) page + i * BLOCK_SECTOR_SIZE);
+}
@@ -0,0 +1,20 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Index of a page-sized slot on the swap device. */
+typedef size_t swap_slot_t;
+
+/* Returned by swap_alloc() when the swap device is full. */
+#define SWAP_ERROR ((swap_slot_t) -1)
+
+void swap_init (void);
+swap_slot_t swap_alloc (void);
+void swap_ref (swap_slot_t);
+void swap_release (swap_slot_t);
+void swap_write (swap_slot_t, const void *page);
+void swap_read (swap_slot_t, void *page);
+
+#endif /* vm/swap.h */